@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <sched.h>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+#include "common.h"
+#include "concurrentRoster.h"
+#include "flatRoster.h"
+#include "memPlacement.h"
+
+/*
+	Microbenchmarks for the pieces shared by the servers:
+	roster loading, command parsing, lookups and error formatting.
+
+	Usage: bench [--sizes <n>,<n>,...] [--reps <n>] [--budget <secs>] [--huge-pages <thp|explicit>]
+
+	Every benchmark is sampled at least --reps times, and keeps sampling
+	(up to 10 * --reps samples or --budget seconds) until the 95% confidence
+	interval of the mean is within 1%, so that a 5% regression stands out.
+	Results are written to stdout as JSON; roster_load and concurrent_load
+	samples time one full load, every other benchmark times a single
+	operation. concurrent_* benchmarks use the updatable in-memory roster;
+	concurrent_mixed replaces an existing student every 100th operation.
+	flat_* benchmarks use the read-only flat roster (see flatRoster.h) on
+	4 KB pages, and again as flat_*_huge on --huge-pages if given. With
+	several NUMA nodes (real ones, or emulated with the numa=fake=<n> boot
+	option), flat_lookup_hit_local and flat_lookup_hit_remote read a copy on
+	the first node and one on the last, from a thread bound to the first.
+*/
+
+// TIMING UTILITIES
+
+static uint64_t nowNanos() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Keeps the compiler from discarding benchmarked work
+static volatile size_t sink;
+
+// Deterministic xorshift generator so every run sees the same rosters
+struct Random {
+	uint64_t state;
+	Random(uint64_t seed): state(seed) {}
+	uint64_t next() {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+};
+
+
+// STATISTICS
+
+struct Stats {
+	size_t samples;
+	double min, median, mean, stddev, p95, ci95Pct;
+};
+
+static Stats computeStats(std::vector<double> v) {
+	Stats s;
+	std::sort(v.begin(), v.end());
+	s.samples = v.size();
+	s.min = v.front();
+	s.median = v[v.size() / 2];
+	s.p95 = v[std::min(v.size() - 1, (size_t) (v.size() * 0.95))];
+
+	double sum = 0;
+	for (size_t i = 0; i < v.size(); i++) sum += v[i];
+	s.mean = sum / v.size();
+
+	double sq = 0;
+	for (size_t i = 0; i < v.size(); i++) sq += (v[i] - s.mean) * (v[i] - s.mean);
+	s.stddev = v.size() > 1 ? sqrt(sq / (v.size() - 1)) : 0;
+	s.ci95Pct = s.mean > 0 ? 100 * 1.96 * s.stddev / sqrt((double) v.size()) / s.mean : 0;
+	return s;
+}
+
+
+// BENCHMARK RUNNER
+
+struct Options {
+	std::vector<size_t> sizes;
+	size_t reps;
+	double budgetSecs;
+	HugePages hugePages;
+};
+
+class Runner {
+	const Options & opts;
+	bool first;
+
+public:
+	Runner(const Options & opts): opts(opts), first(true) {}
+
+	const Options & options() const {
+		return opts;
+	}
+
+	// Runs body(n) repeatedly, where body performs n operations,
+	// and reports nanoseconds per operation
+	template <typename Body>
+	void run(const std::string & name, size_t rosterSize, Body body, size_t batch = 0) {
+		// Calibrate the batch so a single sample takes at least ~200us
+		if (!batch) {
+			batch = 1;
+			while (true) {
+				uint64_t start = nowNanos();
+				body(batch);
+				if (nowNanos() - start > 200000 || batch >= (1u << 24)) break;
+				batch *= 2;
+			}
+		}
+
+		std::vector<double> samples;
+		uint64_t deadline = nowNanos() + (uint64_t) (opts.budgetSecs * 1e9);
+		while (samples.size() < 10 * opts.reps) {
+			uint64_t start = nowNanos();
+			body(batch);
+			uint64_t end = nowNanos();
+			samples.push_back((double) (end - start) / batch);
+
+			if (samples.size() >= opts.reps) {
+				if (computeStats(samples).ci95Pct <= 1.0 || end > deadline) break;
+			} else if (samples.size() >= 3 && end > deadline) {
+				break;
+			}
+		}
+
+		Stats s = computeStats(samples);
+		printf("%s\n    {\"name\": \"%s\", \"roster_size\": %zu, \"unit\": \"ns/op\", "
+			"\"samples\": %zu, \"ops_per_sample\": %zu, \"min\": %.2f, \"median\": %.2f, "
+			"\"mean\": %.2f, \"stddev\": %.2f, \"p95\": %.2f, \"ci95_pct\": %.3f}",
+			first ? "" : ",", name.c_str(), rosterSize, s.samples, batch,
+			s.min, s.median, s.mean, s.stddev, s.p95, s.ci95Pct);
+		fflush(stdout);
+		first = false;
+	}
+};
+
+
+// SYNTHETIC WORKLOAD
+
+static const char * FIRST_NAMES[] = {"Alice", "Bob", "Carol", "David", "Erin", "Frank", "Grace", "Heidi"};
+static const char * LAST_NAMES[] = {"Smith", "Jones", "Nguyen", "Garcia", "Tremblay", "Roy", "Cai", "Wong"};
+static const size_t STUDENTS_PER_GROUP = 100;
+
+static std::string groupIdFor(size_t g) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%zu", 1000 + g);
+	return buf;
+}
+
+static std::string studentIdFor(size_t g, size_t s) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%zu", 20000000 + g * 1000 + s);
+	return buf;
+}
+
+// Roster text in the format read by operator>>, STUDENTS_PER_GROUP students per group
+static std::string makeRoster(size_t students) {
+	std::string out;
+	Random rnd(students);
+	for (size_t i = 0; i < students; i++) {
+		size_t g = i / STUDENTS_PER_GROUP, s = i % STUDENTS_PER_GROUP;
+		if (s == 0) {
+			out += "group " + groupIdFor(g) + "\n";
+		}
+		out += studentIdFor(g, s);
+		out += " ";
+		out += FIRST_NAMES[rnd.next() % 8];
+		out += " ";
+		out += LAST_NAMES[rnd.next() % 8];
+		out += "\n";
+	}
+	return out;
+}
+
+struct Key {
+	std::string groupId, studentId;
+};
+
+// Random existing (hit) or absent (miss) keys for a roster of the given size
+static std::vector<Key> makeKeys(size_t students, bool hit) {
+	std::vector<Key> keys(1 << 16);
+	size_t groups = (students + STUDENTS_PER_GROUP - 1) / STUDENTS_PER_GROUP;
+	Random rnd(students * 31 + hit);
+	for (size_t i = 0; i < keys.size(); i++) {
+		size_t n = rnd.next() % students;
+		size_t g = n / STUDENTS_PER_GROUP, s = n % STUDENTS_PER_GROUP;
+		if (hit) {
+			keys[i].groupId = groupIdFor(g);
+			keys[i].studentId = studentIdFor(g, s);
+		} else if (i % 2) {
+			// existing group, absent student
+			keys[i].groupId = groupIdFor(g);
+			keys[i].studentId = studentIdFor(g, STUDENTS_PER_GROUP + s);
+		} else {
+			// absent group
+			keys[i].groupId = groupIdFor(groups + g);
+			keys[i].studentId = studentIdFor(g, s);
+		}
+	}
+	return keys;
+}
+
+
+// BENCHMARKS
+
+static void benchParse(Runner & runner, const std::string & name, const std::string & input) {
+	runner.run(name, 0, [&](size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			InputBuffer inputBuffer(input);
+			while (inputBuffer.next()) {
+				sink += inputBuffer.error() + inputBuffer.stop() + inputBuffer.stopSession();
+				if (inputBuffer.hasGet()) {
+					sink += inputBuffer.getGroupId().size() + inputBuffer.getStudentId().size();
+				}
+			}
+		}
+	});
+}
+
+static void benchFlatLookups(Runner & runner, const std::string & suffix, size_t students,
+	const FlatRoster & flat, const std::vector<Key> & hits, const std::vector<Key> & misses, bool withMisses) {
+	size_t next = 0;
+	runner.run("flat_lookup_hit" + suffix, students, [&](size_t n) {
+		std::string studentName;
+		for (size_t i = 0; i < n; i++) {
+			const Key & k = hits[next++ & (hits.size() - 1)];
+			sink += flat.find(k.groupId, k.studentId, studentName);
+		}
+	});
+	if (withMisses) {
+		runner.run("flat_lookup_miss" + suffix, students, [&](size_t n) {
+			std::string studentName;
+			for (size_t i = 0; i < n; i++) {
+				const Key & k = misses[next++ & (misses.size() - 1)];
+				sink += flat.find(k.groupId, k.studentId, studentName);
+			}
+		});
+	}
+}
+
+// The read-only flat roster: on 4 KB pages, on huge pages, and local or
+// remote to the reading thread
+static void benchFlat(Runner & runner, size_t students, const std::string & text,
+	const std::vector<Key> & hits, const std::vector<Key> & misses) {
+	FlatRoster * flat = NULL;
+	runner.run("flat_load", students, [&](size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			delete flat;
+			flat = new FlatRoster();
+			std::stringstream in(text);
+			flat->build(in, HUGE_PAGES_NONE, -1);
+		}
+	}, 1);
+	benchFlatLookups(runner, "", students, *flat, hits, misses, true);
+	delete flat;
+
+	HugePages hugePages = runner.options().hugePages;
+	if (hugePages != HUGE_PAGES_NONE) {
+		FlatRoster huge;
+		std::stringstream in(text);
+		if (huge.build(in, hugePages, -1) == 0) {
+			benchFlatLookups(runner, "_huge", students, huge, hits, misses, true);
+		}
+	}
+
+	int nodes = numaNodeCount();
+	if (nodes > 1) {
+		cpu_set_t saved;
+		sched_getaffinity(0, sizeof(saved), &saved);
+		FlatRoster local, remote;
+		std::stringstream in(text);
+		if (bindThreadToNode(0) == 0 && local.build(in, hugePages, 0) == 0 && remote.copy(local, hugePages, nodes - 1) == 0) {
+			benchFlatLookups(runner, "_local", students, local, hits, misses, false);
+			benchFlatLookups(runner, "_remote", students, remote, hits, misses, false);
+		}
+		sched_setaffinity(0, sizeof(saved), &saved);
+	}
+}
+
+static void benchRoster(Runner & runner, size_t students) {
+	std::string text = makeRoster(students);
+	GroupMap groupMap;
+
+	// One load per sample: a load is already far above timer resolution
+	runner.run("roster_load", students, [&](size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			GroupMap loaded;
+			std::stringstream in(text);
+			in >> loaded;
+			groupMap.swap(loaded);
+		}
+	}, 1);
+
+	const GroupMap * map = &groupMap;
+	std::vector<Key> hits = makeKeys(students, true);
+	std::vector<Key> misses = makeKeys(students, false);
+	size_t next = 0;
+
+	runner.run("lookup_hit", students, [&](size_t n) {
+		std::string studentName;
+		for (size_t i = 0; i < n; i++) {
+			const Key & k = hits[next++ & (hits.size() - 1)];
+			sink += lookup(map, k.groupId, k.studentId, studentName);
+		}
+	});
+	runner.run("lookup_miss", students, [&](size_t n) {
+		std::string studentName;
+		for (size_t i = 0; i < n; i++) {
+			const Key & k = misses[next++ & (misses.size() - 1)];
+			sink += lookup(map, k.groupId, k.studentId, studentName);
+		}
+	});
+	benchFlat(runner, students, text, hits, misses);
+	GroupMap().swap(groupMap);
+
+	// The same workload on the updatable roster
+	ConcurrentRoster * roster = NULL;
+	runner.run("concurrent_load", students, [&](size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			delete roster;
+			roster = new ConcurrentRoster();
+			std::stringstream in(text);
+			roster->load(in);
+		}
+	}, 1);
+	text.clear();
+	text.shrink_to_fit();
+
+	runner.run("concurrent_lookup_hit", students, [&](size_t n) {
+		std::string studentName;
+		for (size_t i = 0; i < n; i++) {
+			const Key & k = hits[next++ & (hits.size() - 1)];
+			sink += roster->find(k.groupId, k.studentId, studentName);
+		}
+	});
+	runner.run("concurrent_lookup_miss", students, [&](size_t n) {
+		std::string studentName;
+		for (size_t i = 0; i < n; i++) {
+			const Key & k = misses[next++ & (misses.size() - 1)];
+			sink += roster->find(k.groupId, k.studentId, studentName);
+		}
+	});
+	runner.run("concurrent_mixed", students, [&](size_t n) {
+		std::string studentName;
+		for (size_t i = 0; i < n; i++) {
+			const Key & k = hits[next++ & (hits.size() - 1)];
+			if (next % 100 == 0) {
+				sink += roster->put(k.groupId, k.studentId, FIRST_NAMES[next % 8]);
+			} else {
+				sink += roster->find(k.groupId, k.studentId, studentName);
+			}
+		}
+	});
+	delete roster;
+}
+
+
+// MAIN
+
+static bool parseSizes(const char * arg, std::vector<size_t> & sizes) {
+	sizes.clear();
+	std::stringstream ss(arg);
+	std::string tok;
+	while (std::getline(ss, tok, ',')) {
+		if (!isNumeric(tok)) return false;
+		sizes.push_back(strtoull(tok.c_str(), NULL, 10));
+	}
+	return !sizes.empty();
+}
+
+int main(int argc, char * argv[]) {
+	Options opts;
+	size_t defaultSizes[] = {1000, 10000, 100000, 1000000, 10000000};
+	opts.sizes.assign(defaultSizes, defaultSizes + 5);
+	opts.reps = 30;
+	opts.budgetSecs = 10;
+	opts.hugePages = HUGE_PAGES_NONE;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool ok = i + 1 < argc;
+		if (ok && arg == "--sizes") {
+			ok = parseSizes(argv[++i], opts.sizes);
+		} else if (ok && arg == "--reps") {
+			opts.reps = strtoul(argv[++i], NULL, 10);
+			ok = opts.reps > 0;
+		} else if (ok && arg == "--budget") {
+			opts.budgetSecs = strtod(argv[++i], NULL);
+		} else if (ok && arg == "--huge-pages") {
+			ok = parseHugePages(argv[++i], opts.hugePages);
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			std::cerr << "usage : " << argv[0] << " [--sizes <n>,<n>,...] [--reps <n>] [--budget <secs>] [--huge-pages <thp|explicit>]" << std::endl;
+			return 1;
+		}
+	}
+
+	printf("{\n  \"reps\": %zu,\n  \"budget_secs\": %.1f,\n  \"benchmarks\": [", opts.reps, opts.budgetSecs);
+	Runner runner(opts);
+
+	benchParse(runner, "parse_get", "GET 1042 20042017\n");
+	benchParse(runner, "parse_stop", "STOP\n");
+	benchParse(runner, "parse_malformed", "GET 1042 abc extra\n");
+	runner.run("error_format", 0, [&](size_t n) {
+		std::string groupId = "1042", studentId = "20042017";
+		for (size_t i = 0; i < n; i++) {
+			sink += notFoundError(groupId, studentId).size();
+		}
+	});
+
+	for (size_t i = 0; i < opts.sizes.size(); i++) {
+		if (opts.sizes[i]) {
+			benchRoster(runner, opts.sizes[i]);
+		}
+	}
+
+	printf("\n  ]\n}\n");
+	return 0;
+}
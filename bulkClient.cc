@@ -0,0 +1,287 @@
+#include <fcntl.h>
+#include <iostream>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "bulkClient.h"
+#include "clientMain.h"
+
+static double seconds(const timespec & from, const timespec & to) {
+	return (to.tv_sec - from.tv_sec) + (to.tv_nsec - from.tv_nsec) / 1e9;
+}
+
+
+// BULK JOB
+// The mapped input, and the replies not written out yet
+
+struct BulkJob {
+	const char * data;
+	std::vector<size_t> starts;			// line i is [starts[i], starts[i + 1])
+	size_t lines;
+	const std::vector<sockaddr_in> * servers;
+	ClientOptions options;
+	int workers;
+
+	pthread_mutex_t m;
+	pthread_cond_t ready;				// the next line to write is in
+	pthread_cond_t room;				// a window has room again, or emptied
+	std::vector<std::string> replies;
+	std::vector<char> done;
+	std::vector<size_t> inFlight;		// per worker
+	size_t next;						// the next line to write
+	size_t failed;
+	ClientCacheStats cache;
+};
+
+struct BulkWorker {
+	BulkJob * job;
+	int index;
+	pthread_t id;
+	bool connected;
+};
+
+// reply, on one line (see bulkClient.h)
+static std::string escape(const std::string & reply) {
+	if (reply.find_first_of("\\\n") == std::string::npos) {
+		return reply;
+	}
+	std::string escaped;
+	for (size_t i = 0; i < reply.length(); i++) {
+		if (reply[i] == '\n') {
+			escaped += "\\n";
+		} else if (reply[i] == '\\') {
+			escaped += "\\\\";
+		} else {
+			escaped += reply[i];
+		}
+	}
+	return escaped;
+}
+
+static void complete(BulkJob * job, int worker, size_t line, const ClientReply & reply) {
+	std::string escaped = reply.status < 0 ? "" : escape(reply.reply);
+	pthread_mutex_lock(&job->m);
+	if (reply.status < 0) {
+		job->replies[line] = "ERROR_NO_REPLY";
+		job->failed++;
+	} else {
+		job->replies[line].swap(escaped);
+	}
+	job->done[line] = 1;
+	if (line == job->next) {
+		pthread_cond_signal(&job->ready);
+	}
+	// The worker waits for room in its window, and at the end for nothing to be left
+	size_t left = --job->inFlight[worker];
+	if (left == BULK_WINDOW - 1 || left == 0) {
+		pthread_cond_broadcast(&job->room);
+	}
+	pthread_mutex_unlock(&job->m);
+}
+
+static void * runWorker(void * arg) {
+	BulkWorker * worker = (BulkWorker *) arg;
+	BulkJob * job = worker->job;
+	RosterClient client(*job->servers, job->options);
+	worker->connected = client.connect() == 0;
+
+	// Every line is answered, if only with ERROR_NO_REPLY: a client that
+	// could not connect fails the requests made of it
+	size_t batch = worker->index;
+	for (size_t first = batch * BULK_BATCH_LINES; first < job->lines; first += (size_t) job->workers * BULK_BATCH_LINES) {
+		size_t last = first + BULK_BATCH_LINES < job->lines ? first + BULK_BATCH_LINES : job->lines;
+		for (size_t line = first; line < last; line++) {
+			pthread_mutex_lock(&job->m);
+			while (job->inFlight[worker->index] >= BULK_WINDOW) {
+				pthread_cond_wait(&job->room, &job->m);
+			}
+			job->inFlight[worker->index]++;
+			pthread_mutex_unlock(&job->m);
+
+			std::string input(job->data + job->starts[line], job->starts[line + 1] - job->starts[line]);
+			int index = worker->index;
+			client.request(toCommand(input), [job, index, line](const ClientReply & reply) {
+				complete(job, index, line, reply);
+			});
+		}
+	}
+
+	// Wait for the last replies before closing the connections
+	pthread_mutex_lock(&job->m);
+	while (job->inFlight[worker->index] > 0) {
+		pthread_cond_wait(&job->room, &job->m);
+	}
+	ClientCacheStats stats = client.cacheStats();
+	job->cache.hits += stats.hits;
+	job->cache.misses += stats.misses;
+	job->cache.stale += stats.stale;
+	job->cache.evictions += stats.evictions;
+	pthread_mutex_unlock(&job->m);
+	return NULL;
+}
+
+
+// BULK MAIN
+
+int runBulk(const char * inPath, const char * outPath, const std::vector<sockaddr_in> & servers, const ClientOptions & options, int workers) {
+	// Step 1: Map the input, and find where its lines start
+	int fd = open(inPath, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror("Bulk input:");
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+	size_t size = st.st_size;
+	const char * data = "";
+	if (size > 0) {
+		void * mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mem == MAP_FAILED) {
+			perror("Bulk input mmap:");
+			close(fd);
+			return 1;
+		}
+		madvise(mem, size, MADV_SEQUENTIAL);
+		data = (const char *) mem;
+	}
+	close(fd);
+
+	FILE * out = fopen(outPath, "w");
+	if (out == NULL) {
+		perror("Bulk output:");
+		if (size > 0) munmap((void *) data, size);
+		return 1;
+	}
+
+	BulkJob job;
+	job.data = data;
+	for (size_t pos = 0; pos < size; ) {
+		job.starts.push_back(pos);
+		const char * eol = (const char *) memchr(data + pos, '\n', size - pos);
+		pos = eol == NULL ? size : eol - data + 1;
+	}
+	job.lines = job.starts.size();
+	job.starts.push_back(size);
+	job.servers = &servers;
+	job.options = options;
+	job.workers = workers;
+	job.replies.resize(job.lines);
+	job.done.assign(job.lines, 0);
+	job.inFlight.assign(workers, 0);
+	job.next = 0;
+	job.failed = 0;
+	job.cache.hits = job.cache.misses = job.cache.stale = job.cache.evictions = 0;
+
+	pthread_mutex_init(&job.m, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&job.ready, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&job.room, NULL);
+
+	// Step 2: Start the workers
+	timespec start, now, lastReport;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	lastReport = start;
+	std::vector<BulkWorker> pool(workers);
+	int started = 0;
+	for (int w = 0; w < workers; w++) {
+		pool[w].job = &job;
+		pool[w].index = w;
+		pool[w].connected = false;
+		if (pthread_create(&pool[w].id, NULL, runWorker, &pool[w]) != 0) {
+			perror("Bulk worker:");
+			break;
+		}
+		started++;
+	}
+
+	// The lines dealt to workers that could not start are failed, so that
+	// every line of input still gets its line of output
+	pthread_mutex_lock(&job.m);
+	for (int w = started; w < workers; w++) {
+		for (size_t first = (size_t) w * BULK_BATCH_LINES; first < job.lines; first += (size_t) workers * BULK_BATCH_LINES) {
+			size_t last = first + BULK_BATCH_LINES < job.lines ? first + BULK_BATCH_LINES : job.lines;
+			for (size_t line = first; line < last; line++) {
+				job.replies[line] = "ERROR_NO_REPLY";
+				job.done[line] = 1;
+				job.failed++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&job.m);
+
+	// Step 3: Write the replies in input order as they come in, and report
+	// progress every second
+	std::string buf;
+	pthread_mutex_lock(&job.m);
+	for (;;) {
+		while (job.next < job.lines && job.done[job.next]) {
+			buf += job.replies[job.next];
+			buf += '\n';
+			std::string().swap(job.replies[job.next]);
+			job.next++;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (seconds(lastReport, now) >= 1) {
+			std::cerr << "Bulk: " << job.next << "/" << job.lines << " lines, "
+				<< (size_t) (job.next / seconds(start, now)) << " lines/s" << std::endl;
+			lastReport = now;
+		}
+		if (!buf.empty()) {
+			pthread_mutex_unlock(&job.m);
+			fwrite(buf.data(), 1, buf.length(), out);
+			buf.clear();
+			pthread_mutex_lock(&job.m);
+			continue;
+		}
+		if (job.next == job.lines) {
+			break;
+		}
+
+		timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += 1;
+		pthread_cond_timedwait(&job.ready, &job.m, &deadline);
+	}
+	pthread_mutex_unlock(&job.m);
+
+	// Step 4: Wait for the workers, and sum up
+	int connected = 0;
+	for (int w = 0; w < started; w++) {
+		pthread_join(pool[w].id, NULL);
+		connected += pool[w].connected;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	bool written = fclose(out) == 0;
+	if (size > 0) munmap((void *) data, size);
+	pthread_cond_destroy(&job.room);
+	pthread_cond_destroy(&job.ready);
+	pthread_mutex_destroy(&job.m);
+
+	double elapsed = seconds(start, now);
+	std::cerr << "Bulk: " << job.next << " lines in " << elapsed << " s ("
+		<< (size_t) (elapsed > 0 ? job.next / elapsed : job.next) << " lines/s), "
+		<< job.failed << " without a reply" << std::endl;
+	if (options.cacheEntries > 0) {
+		uint64_t lookups = job.cache.hits + job.cache.misses;
+		std::cerr << "Cache: " << job.cache.hits << " hits, " << job.cache.misses << " misses, hit ratio "
+			<< (lookups ? 100.0 * job.cache.hits / lookups : 0.0) << "% (" << job.cache.stale << " stale, "
+			<< job.cache.evictions << " evicted)" << std::endl;
+	}
+	if (started < workers || connected < workers) {
+		std::cerr << "connection error" << std::endl;
+		return 1;
+	}
+	if (!written) {
+		perror("Bulk output:");
+		return 1;
+	}
+	return 0;
+}
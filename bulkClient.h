@@ -0,0 +1,28 @@
+#ifndef BULK_CLIENT_H
+#define BULK_CLIENT_H
+
+#include <netinet/in.h>
+#include <vector>
+#include "rosterClient.h"
+
+// BULK CLIENT
+// client --bulk <input> <output>: for jobs with millions of lines. Every
+// line of input is sent as if typed to the client, and its reply written
+// to output on the line of the same number (ERROR_NO_REPLY when there was
+// none). A reply of several lines (FIND, WHERE) is kept on one: its line
+// breaks are written as \n, and its backslashes doubled
+//
+// The input is memory-mapped and cut into batches of BULK_BATCH_LINES
+// lines, dealt round-robin to the workers. Each worker has a RosterClient
+// of its own (its own connections, or its own UDP socket retransmitting
+// lost requests) and keeps up to BULK_WINDOW requests in flight. Replies
+// are written in input order as soon as the ones before them are in.
+// Progress goes to stderr every second, and a throughput summary at the end
+
+#define BULK_BATCH_LINES 1024
+#define BULK_WINDOW 4096
+
+// Returns the process exit code
+int runBulk(const char * inPath, const char * outPath, const std::vector<sockaddr_in> & servers, const ClientOptions & options, int workers);
+
+#endif
@@ -0,0 +1,132 @@
+#include "clientCache.h"
+
+// CLIENT CACHE
+
+ClientCache::ClientCache(size_t capacity, uint64_t ttlMillis, unsigned int shards):
+	entries(capacity ? capacity : 1),
+	hand(0),
+	versions(shards, 0),
+	updating(shards, 0),
+	ttlMillis(ttlMillis)
+{
+	pthread_mutex_init(&m, NULL);
+	for (size_t e = 0; e < entries.size(); e++) {
+		entries[e].used = false;
+		entries[e].referenced = false;
+	}
+	index.reserve(entries.size());
+	stats.hits = stats.misses = stats.stale = stats.evictions = 0;
+}
+
+ClientCache::~ClientCache() {
+	pthread_mutex_destroy(&m);
+}
+
+void ClientCache::drop(size_t e) {
+	index.erase(entries[e].key);
+	entries[e].used = false;
+	entries[e].referenced = false;
+	entries[e].key.clear();
+	entries[e].reply.clear();
+}
+
+// The slot for a new entry: a free one, or the first one the hand finds
+// without its reference bit
+size_t ClientCache::victim() {
+	while (1) {
+		Entry & entry = entries[hand];
+		size_t e = hand;
+		hand = (hand + 1) % entries.size();
+		if (!entry.used) {
+			return e;
+		}
+		if (!entry.referenced) {
+			drop(e);
+			stats.evictions++;
+			return e;
+		}
+		entry.referenced = false;
+	}
+}
+
+bool ClientCache::lookup(unsigned int shard, const std::string & key, uint64_t nowMs, std::string & reply) {
+	pthread_mutex_lock(&m);
+	std::unordered_map<std::string, size_t>::iterator it = index.find(key);
+	if (it == index.end() || updating[shard]) {
+		stats.misses++;
+		pthread_mutex_unlock(&m);
+		return false;
+	}
+
+	Entry & entry = entries[it->second];
+	if (entry.version != versions[shard] || nowMs >= entry.expires) {
+		drop(it->second);
+		stats.stale++;
+		stats.misses++;
+		pthread_mutex_unlock(&m);
+		return false;
+	}
+	entry.referenced = true;
+	reply = entry.reply;
+	stats.hits++;
+	pthread_mutex_unlock(&m);
+	return true;
+}
+
+void ClientCache::insert(unsigned int shard, const std::string & key, const std::string & reply, uint64_t version, uint64_t nowMs) {
+	pthread_mutex_lock(&m);
+	if (version == 0 || version != versions[shard] || updating[shard]) {
+		pthread_mutex_unlock(&m);
+		return;
+	}
+
+	std::unordered_map<std::string, size_t>::iterator it = index.find(key);
+	size_t e;
+	if (it != index.end()) {
+		e = it->second;
+	} else {
+		e = victim();
+		index[key] = e;
+	}
+	Entry & entry = entries[e];
+	entry.key = key;
+	entry.reply = reply;
+	entry.version = version;
+	entry.expires = nowMs + ttlMillis;
+	entry.used = true;
+	pthread_mutex_unlock(&m);
+}
+
+uint64_t ClientCache::version(unsigned int shard) {
+	pthread_mutex_lock(&m);
+	uint64_t v = versions[shard];
+	pthread_mutex_unlock(&m);
+	return v;
+}
+
+void ClientCache::learn(unsigned int shard, uint64_t version) {
+	pthread_mutex_lock(&m);
+	if (version > versions[shard]) {
+		versions[shard] = version;
+	}
+	pthread_mutex_unlock(&m);
+}
+
+void ClientCache::beginUpdate(unsigned int shard) {
+	pthread_mutex_lock(&m);
+	updating[shard]++;
+	pthread_mutex_unlock(&m);
+}
+
+void ClientCache::endUpdate(unsigned int shard) {
+	pthread_mutex_lock(&m);
+	updating[shard]--;
+	pthread_mutex_unlock(&m);
+}
+
+ClientCacheStats ClientCache::getStats() {
+	pthread_mutex_lock(&m);
+	ClientCacheStats s = stats;
+	pthread_mutex_unlock(&m);
+	return s;
+}
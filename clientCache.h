@@ -0,0 +1,85 @@
+#ifndef CLIENT_CACHE_H
+#define CLIENT_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// CLIENT CACHE
+// GET replies kept by RosterClient, so that a key asked for again is
+// answered without a round trip: names, and the ERROR_<group>_<student> of
+// students that don't exist (negative entries), alike
+//
+// Bounded to a fixed number of entries, evicted with CLOCK: a hit sets the
+// entry's reference bit, and the hand sweeping for a victim clears the
+// bits it passes and takes the first entry without one. Every entry
+// expires ttlMillis after it was stored.
+//
+// Every entry is also tagged with the roster version (see execute() in
+// common.h) of the server that answered, and is only good while that is
+// still the version the client knows for the server. The client learns
+// newer versions from the "!VERSION" notice of any reply (versions only
+// grow, across restarts too). While one of the client's own updates is on
+// its way to a server, nothing is looked up or stored for that server, so
+// the client always reads its own writes. Changes made by other clients
+// are seen the next time a request goes to the server; until then the TTL
+// bounds how stale a hit can be
+
+struct ClientCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stale;					// misses on an expired or outdated entry
+	uint64_t evictions;
+};
+
+class ClientCache {
+	struct Entry {
+		std::string key;
+		std::string reply;
+		uint64_t version;
+		uint64_t expires;			// ms, CLOCK_MONOTONIC
+		bool used;
+		bool referenced;
+	};
+
+	pthread_mutex_t m;
+	std::vector<Entry> entries;
+	std::unordered_map<std::string, size_t> index;
+	size_t hand;
+	std::vector<uint64_t> versions;	// known per shard, 0 if unknown
+	std::vector<unsigned int> updating;	// updates in flight per shard
+	uint64_t ttlMillis;
+	ClientCacheStats stats;
+
+	void drop(size_t e);
+	size_t victim();
+
+public:
+	ClientCache(size_t capacity, uint64_t ttlMillis, unsigned int shards);
+	~ClientCache();
+
+	// Looks up key ("<group> <student>") on shard at nowMs
+	// Returns true and sets reply on a hit; otherwise returns false
+	bool lookup(unsigned int shard, const std::string & key, uint64_t nowMs, std::string & reply);
+
+	// Stores reply for key, as the server answered at version; ignored if
+	// that is no longer the version known for shard
+	void insert(unsigned int shard, const std::string & key, const std::string & reply, uint64_t version, uint64_t nowMs);
+
+	// The version known for shard (0 if none), which requests carry
+	uint64_t version(unsigned int shard);
+
+	// Records a newer version for shard: entries tagged with an older one are stale
+	void learn(unsigned int shard, uint64_t version);
+
+	// Brackets an update sent to shard, from sending it to its reply (or failure)
+	void beginUpdate(unsigned int shard);
+	void endUpdate(unsigned int shard);
+
+	ClientCacheStats getStats();
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include <deque>
+#include <iostream>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "bulkClient.h"
+#include "clientMain.h"
+#include "common.h"
+#include "rosterClient.h"
+#include "shmTransport.h"
+
+// Most requests sent ahead of the answers being printed
+#define MAX_OUTSTANDING 65536
+
+// STDIN LINES
+// Read unbuffered, so that ready() can tell whether the next line is
+// available without blocking
+
+class LineReader {
+	std::string buf;
+	bool eof;
+
+public:
+	LineReader(): eof(false) {}
+
+	// Whether next() would return without waiting for the user
+	bool ready() const {
+		if (eof || buf.find('\n') != std::string::npos) {
+			return true;
+		}
+		pollfd p = {STDIN_FILENO, POLLIN, 0};
+		return poll(&p, 1, 0) > 0;
+	}
+
+	// Returns false at the end of input
+	bool next(std::string & line) {
+		while (!eof && buf.find('\n') == std::string::npos) {
+			char chunk[4096];
+			int l = read(STDIN_FILENO, chunk, sizeof(chunk));
+			if (l <= 0) {
+				eof = true;
+			} else {
+				buf.append(chunk, l);
+			}
+		}
+		if (buf.empty()) {
+			return false;
+		}
+		size_t len = buf.find('\n');
+		len = len == std::string::npos ? buf.length() : len + 1;
+		line = buf.substr(0, len);
+		buf.erase(0, len);
+		return true;
+	}
+};
+
+
+// ANSWERS IN INPUT ORDER
+
+struct Answer {
+	std::string input;
+	bool done;
+	ClientReply reply;
+};
+
+static void printAnswer(const Answer * answer) {
+	const std::string & received = answer->reply.reply;
+	if (answer->reply.status < 0) {
+		std::cerr << "error: no reply for " << answer->input;
+	} else if (received.find("ERROR", 0) != std::string::npos) {
+		if (received.find("INVALID", 6) != std::string::npos) {
+			std::cerr << "error: invalid input" << std::endl;
+		} else {
+			std::cerr << "error: " << answer->input;
+		}
+	} else {
+		std::cout << received << std::endl;
+	}
+}
+
+class AnswerQueue {
+	pthread_mutex_t m;
+	pthread_cond_t ready;
+	std::deque<Answer *> answers;
+
+public:
+	AnswerQueue() {
+		pthread_mutex_init(&m, NULL);
+		pthread_cond_init(&ready, NULL);
+	}
+	~AnswerQueue() {
+		pthread_cond_destroy(&ready);
+		pthread_mutex_destroy(&m);
+	}
+
+	Answer * add(const std::string & input) {
+		Answer * answer = new Answer;
+		answer->input = input;
+		answer->done = false;
+		pthread_mutex_lock(&m);
+		answers.push_back(answer);
+		pthread_mutex_unlock(&m);
+		return answer;
+	}
+
+	// Called from the I/O thread
+	void complete(Answer * answer, const ClientReply & reply) {
+		pthread_mutex_lock(&m);
+		answer->reply = reply;
+		answer->done = true;
+		if (answer == answers.front()) {
+			pthread_cond_signal(&ready);
+		}
+		pthread_mutex_unlock(&m);
+	}
+
+	// Prints the answers that are in, in order, waiting until at most
+	// maxLeft are outstanding
+	void print(size_t maxLeft) {
+		pthread_mutex_lock(&m);
+		while (!answers.empty()) {
+			Answer * answer = answers.front();
+			if (!answer->done) {
+				if (answers.size() <= maxLeft) break;
+				pthread_cond_wait(&ready, &m);
+				continue;
+			}
+			answers.pop_front();
+			printAnswer(answer);
+			delete answer;
+		}
+		pthread_mutex_unlock(&m);
+	}
+};
+
+
+// CLIENT MAIN
+
+std::string toCommand(const std::string & input) {
+	std::string command = input.substr(0, input.find_last_not_of("\r\n") + 1);
+	char op[4] = "";
+	strncpy(op, command.c_str(), 3);
+	bool update = (!strcasecmp(op, "PUT") || !strcasecmp(op, "DEL")) && isspace(command[3]);
+	bool admin = (!strncasecmp(command.c_str(), "TRACE", 5) && (command.length() == 5 || isspace(command[5])))
+		|| !strcasecmp(command.c_str(), "STATS");
+	bool find = (!strncasecmp(command.c_str(), "FIND", 4) && isspace(command[4]))
+		|| (!strncasecmp(command.c_str(), "WHERE", 5) && isspace(command[5]));
+	if (!update && !admin && !find) {
+		command = "GET " + command;
+	}
+	return command;
+}
+
+// The client over shared memory (see shmTransport.h): one request at a
+// time, since a round trip takes less than reading the next line
+static int runShmClient(const std::string & path) {
+	ShmClient client;
+	if (client.connect(path) < 0) {
+		std::cerr << "connection error" << std::endl;
+		return 1;
+	}
+
+	LineReader reader;
+	std::string input;
+	while (reader.next(input)) {
+		Answer answer;
+		answer.input = input;
+		if (input == "STOP\n") {
+			client.request("STOP", answer.reply.reply);
+			break;
+		}
+		answer.reply.status = client.request(toCommand(input), answer.reply.reply);
+		printAnswer(&answer);
+		if (answer.reply.status < 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int runClient(int argc, char * argv[], bool udp) {
+	// Step 1: Parse the options and the server list
+	ClientOptions options;
+	options.udp = udp;
+	if (argc == 3 && strcmp(argv[1], "--shm") == 0) {
+		return runShmClient(argv[2]);
+	}
+	const char * bulkIn = NULL;
+	const char * bulkOut = NULL;
+	int workers = 4;
+	int first = 1;
+	while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+		if (strcmp(argv[first], "--bulk") == 0 && first + 2 < argc) {
+			bulkIn = argv[first + 1];
+			bulkOut = argv[first + 2];
+			first += 3;
+			continue;
+		}
+		if (first + 1 >= argc || !isNumeric(argv[first + 1])) {
+			break;
+		}
+		int value = atoi(argv[first + 1]);
+		if (strcmp(argv[first], "--pool") == 0 && value > 0) {
+			options.connectionsPerServer = value;
+		} else if (strcmp(argv[first], "--workers") == 0 && value > 0) {
+			workers = value;
+		} else if (strcmp(argv[first], "--cache") == 0) {
+			options.cacheEntries = value;
+		} else if (strcmp(argv[first], "--cache-ttl") == 0 && value > 0) {
+			options.cacheTtlMillis = value;
+		} else {
+			break;
+		}
+		first += 2;
+	}
+	if (argc - first < 2 || (argc - first) % 2) {
+		std::cerr << "usage : " << argv[0] << " [--pool <n>] [--cache <n>] [--cache-ttl <ms>] <server name/ip> <server port> [<server name/ip> <server port> ...]" << std::endl;
+		std::cerr << "        " << argv[0] << " --bulk <input> <output> [--workers <n>] [--pool <n>] [--cache <n>] [--cache-ttl <ms>] <server name/ip> <server port> [...]" << std::endl;
+		std::cerr << "        " << argv[0] << " --shm <path>" << std::endl;
+		return 0;
+	}
+
+	std::vector<sockaddr_in> servers;
+	for (int i = first; i + 1 < argc; i += 2) {
+		sockaddr_in addr;
+		if (resolveServer(argv[i], argv[i + 1], &addr) < 0) {
+			return 3;
+		}
+		servers.push_back(addr);
+	}
+
+	if (bulkIn != NULL) {
+		return runBulk(bulkIn, bulkOut, servers, options, workers);
+	}
+
+	// Step 2: Connect
+	RosterClient client(servers, options);
+	if (client.connect() < 0) {
+		std::cerr << "connection error" << std::endl;
+		return 1;
+	}
+
+	// Step 3: Send each line as it is read; print the answers in order
+	// whenever waiting for more input
+	LineReader reader;
+	AnswerQueue answers;
+	std::string input;
+	while (1) {
+		if (!reader.ready()) {
+			answers.print(0);
+		}
+		if (!reader.next(input)) {
+			break;
+		}
+		if (input == "STOP\n") {
+			answers.print(0);
+			client.stopServers();
+			break;
+		}
+
+		std::string command = toCommand(input);
+		Answer * answer = answers.add(input);
+		client.request(command, [&answers, answer](const ClientReply & reply) {
+			answers.complete(answer, reply);
+		});
+		answers.print(MAX_OUTSTANDING);
+	}
+
+	// Step 4: Wait for the last answers; closing the connections ends the session
+	answers.print(0);
+	if (options.cacheEntries > 0) {
+		ClientCacheStats stats = client.cacheStats();
+		uint64_t lookups = stats.hits + stats.misses;
+		std::cerr << "Cache: " << stats.hits << " hits, " << stats.misses << " misses, hit ratio "
+			<< (lookups ? 100.0 * stats.hits / lookups : 0.0) << "% (" << stats.stale << " stale, "
+			<< stats.evictions << " evicted)" << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef CLIENT_MAIN_H
+#define CLIENT_MAIN_H
+
+// CLIENT MAIN
+// The command line client behind clientTCP and clientUDP, on top of
+// RosterClient (see rosterClient.h)
+//
+// Usage: client [--pool <n>] [--cache <n>] [--cache-ttl <ms>] <server name/ip> <server port> [<server name/ip> <server port> ...]
+//        client --bulk <input> <output> [--workers <n>] [--pool <n>] [--cache <n>] [--cache-ttl <ms>] <server name/ip> <server port> [...]
+//        client --shm <path>
+//
+// Every input line is a GET ("<group> <student>"), or a PUT, DEL, FIND, WHERE,
+// TRACE or STATS sent as is. With several servers, requests are sharded across
+// them by group ID (split the roster with splitRoster to match); a FIND without
+// a group, or a WHERE, only searches one server's shard. Input that is
+// already available is sent ahead without waiting for replies; the answers
+// are printed in input order. EOF ends the session, STOP stops the servers
+//
+// --cache keeps up to n GET replies (names and not found errors), each
+// good for --cache-ttl ms (default 10000), and invalidated when the roster
+// changes (see clientCache.h); the hit ratio is printed on exit
+//
+// --bulk runs the lines of the input file on --workers workers (default 4)
+// and writes the replies to the output file, in order (see bulkClient.h)
+//
+// With --shm, the client talks to the server on this host listening on the
+// Unix socket path (server --shm <path>) through shared memory
+
+#include <string>
+
+// The command sent for an input line: PUT, DEL, FIND, WHERE, TRACE and STATS
+// are sent as they are, anything else is a GET
+std::string toCommand(const std::string & input);
+
+// Returns the process exit code
+int runClient(int argc, char * argv[], bool udp);
+
+#endif
@@ -0,0 +1,362 @@
+#include <atomic>
+#include <ctype.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "common.h"
+#include "roster.h"
+#include "trace.h"
+
+// STRING UTILITIES
+
+std::string trim(std::string line) {
+	int left, right;
+	for (left = 0; left < line.length() && isspace(line[left]); left++);
+	for (right = line.length() - 1; right >= left && isspace(line[right]); right--);
+	if (right >= left) {
+		return line.substr(left, right - left + 1);
+	}
+	return "";
+}
+
+bool isNumeric(std::string str) {
+	if (!str.length()) {
+		return false;
+	}
+	for (unsigned int i = 0; i < str.length(); i++) {
+		if (!isdigit(str[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string & tolower(std::string & str) {
+	for (int i = 0; i < str.length(); i++) {
+		if (isupper(str[i])) {
+			str[i] = tolower(str[i]);
+		}
+	}
+	return str;
+}
+
+
+// GROUP MAP
+
+bool RosterReader::next(std::string & _groupId, std::string & studentId, std::string & studentName) {
+	std::string line;
+
+	while (std::getline(in, line)) {
+		std::stringstream ss(line);
+		studentId.clear();
+		ss >> studentId >> std::ws;
+
+		if (tolower(studentId) == "group") {
+			// this is a group ID declaration
+			// the next token will be the group ID
+			ss >> groupId;
+		} else {
+			// extract the first token as studentId
+			// the remainder of the line is the studentName
+			studentName.clear();
+			std::getline(ss, studentName);
+			_groupId = groupId;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::istream & operator>>(std::istream & in, GroupMap & groupMap) {
+	RosterReader reader(in);
+	std::string groupId, studentId, studentName;
+
+	while (reader.next(groupId, studentId, studentName)) {
+		groupMap[groupId][studentId] = studentName;
+	}
+
+	return in;
+}
+
+bool lookup(
+	const GroupMap * groupMap,
+	const std::string & groupId,
+	const std::string & studentId,
+	std::string & studentName
+) {
+	// group corresponds to groupMap[groupId]
+	GroupMap::const_iterator group = groupMap->find(groupId);
+	// Check if groupMap[groupId] exists
+	// and groupMap[groupId][studentId] exists
+	if (group == groupMap->end()) {
+		return false;
+	}
+	std::map<std::string, std::string>::const_iterator student = group->second.find(studentId);
+	if (student == group->second.end()) {
+		return false;
+	}
+	studentName = student->second;
+	return true;
+}
+
+std::string notFoundError(const std::string & groupId, const std::string & studentId) {
+	std::stringstream err;
+	err << "ERROR_" << groupId << "_" << studentId;
+	return err.str();
+}
+
+
+// INPUT BUFFER
+
+bool InputBuffer::next() {
+	tag.clear();
+	version.clear();
+	versioned = false;
+	op.clear();
+	get.clear();
+	name.clear();
+	after.clear();
+
+	std::string line;
+	if (!std::getline(ss, line)) {
+		return false;
+	}
+
+	// Split off the tag
+	size_t start = line.find_first_not_of(" \t");
+	if (start != std::string::npos && line[start] == '#') {
+		size_t end = line.find_first_of(" \t", start);
+		tag = line.substr(start, end - start);
+		line = end == std::string::npos ? "" : line.substr(end);
+	}
+
+	// Split off the version the client caches against
+	start = line.find_first_not_of(" \t");
+	if (start != std::string::npos && line[start] == '!') {
+		size_t end = line.find_first_of(" \t", start);
+		version = line.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1);
+		versioned = true;
+		line = end == std::string::npos ? "" : line.substr(end);
+	}
+
+	std::stringstream line_ss(line);
+	if (!(line_ss >> tok)) {
+		tok = "";
+	} else {
+		// Tokenize GET and DEL commands; PUT is followed by a key and a name
+		op = tolower(tok);
+		if (op == "get" || op == "del" || op == "trace" || op == "where") {
+			while (line_ss >> tok) {
+				get.push_back(tok);
+			}
+		} else if (op == "put") {
+			for (int i = 0; i < 2 && line_ss >> tok; i++) {
+				get.push_back(tok);
+			}
+			std::getline(line_ss >> std::ws, name);
+			name = trim(name);
+		} else if (op == "find") {
+			// An optional group, then the prefix (the rest of the line)
+			std::getline(line_ss >> std::ws, name);
+			name = trim(name);
+			size_t space = name.find_first_of(" \t");
+			if (space != std::string::npos && isNumeric(name.substr(0, space))) {
+				get.push_back(name.substr(0, space));
+				name = trim(name.substr(space));
+			}
+
+			// and optionally the cursor: "AFTER <group> <student>" at the end
+			std::vector<std::string> words;
+			std::stringstream name_ss(name);
+			for (std::string word; name_ss >> word; ) {
+				words.push_back(word);
+			}
+			size_t n = words.size();
+			if (n >= 4 && tolower(words[n - 3]) == "after" && isNumeric(words[n - 2]) && isNumeric(words[n - 1])) {
+				after.push_back(words[n - 2]);
+				after.push_back(words[n - 1]);
+				for (int w = 0; w < 3; w++) {
+					name = trim(name.substr(0, name.find_last_of(" \t")));
+				}
+			}
+		}
+		tok = trim(tolower(line));
+	}
+	return true;
+}
+
+
+// REQUEST ENGINE
+
+// Microseconds since the epoch at startup: versions of an earlier run of
+// the server are all smaller
+static uint64_t startVersion() {
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static std::atomic<uint64_t> rosterVersion(startVersion());
+
+// A line per record, then "END <n>", or "MORE <n>" if there were more
+// records than the engine returned or than fit in one reply (a FIND gets
+// the rest with "AFTER <group> <student>" of the last line)
+static std::string formatRecords(const std::vector<RosterRecord> & records, bool more) {
+	std::stringstream ss;
+	size_t n = 0;
+	for (; n < records.size(); n++) {
+		const RosterRecord & r = records[n];
+		if ((size_t) ss.tellp() + r.groupId.length() + r.studentId.length() + r.studentName.length() + 16 > FIND_MAX_REPLY_BYTES) {
+			more = true;
+			break;
+		}
+		ss << r.groupId << " " << r.studentId << " " << r.studentName << "\n";
+	}
+	ss << (more ? "MORE " : "END ") << n;
+	return ss.str();
+}
+
+static bool executeCommand(const InputBuffer & inputBuffer, Roster * roster, std::string & reply) {
+	// Error case
+	if (inputBuffer.error()) {
+		reply = "ERROR_INVALID_INPUT";
+		return true;
+	}
+
+	std::string groupId = inputBuffer.getGroupId();
+	std::string studentId = inputBuffer.getStudentId();
+
+	// GET case
+	if (inputBuffer.hasGet()) {
+		if (!roster->find(groupId, studentId, reply)) {
+			// [groupId][studentId] does not exist
+			reply = notFoundError(groupId, studentId);
+		}
+		return true;
+	}
+
+	// TRACE case
+	if (inputBuffer.hasTrace()) {
+		if (!inputBuffer.getTraceEvery().empty()) {
+			traceSetEvery(strtoul(inputBuffer.getTraceEvery().c_str(), NULL, 10));
+			reply = "OK";
+		} else {
+			std::string path = traceDump();
+			reply = path.empty() ? "ERROR_WRITE_FAILED" : "OK " + path;
+		}
+		return true;
+	}
+
+	// FIND and WHERE cases
+	if (inputBuffer.hasFind() || inputBuffer.hasWhere()) {
+		std::vector<RosterRecord> records;
+		RosterRecord after = {inputBuffer.getCursorGroup(), inputBuffer.getCursorStudent(), ""};
+		int more = inputBuffer.hasFind()
+			? roster->findByName(inputBuffer.getFindGroup(), inputBuffer.getPrefix(), inputBuffer.hasCursor() ? &after : NULL, records)
+			: roster->whereStudent(studentId, records);
+		if (more == -2) {
+			// The record to resume after was deleted or renamed since
+			reply = "ERROR_NO_CURSOR";
+		} else if (more < 0) {
+			reply = "ERROR_NO_INDEX";
+		} else {
+			reply = formatRecords(records, more);
+		}
+		return true;
+	}
+
+	// PUT and DEL cases
+	if ((inputBuffer.hasPut() || inputBuffer.hasDel()) && !roster->writable()) {
+		reply = "ERROR_READ_ONLY";
+		return true;
+	}
+	if (inputBuffer.hasPut()) {
+		if (roster->put(groupId, studentId, inputBuffer.getStudentName())) {
+			rosterVersion.fetch_add(1);
+			reply = "OK";
+		} else {
+			reply = "ERROR_WRITE_FAILED";
+		}
+		return true;
+	}
+	if (inputBuffer.hasDel()) {
+		int removed = roster->del(groupId, studentId);
+		if (removed > 0) {
+			rosterVersion.fetch_add(1);
+		}
+		reply = removed > 0 ? "OK" : removed == 0 ? notFoundError(groupId, studentId) : "ERROR_WRITE_FAILED";
+		return true;
+	}
+	return false;
+}
+
+bool execute(const InputBuffer & inputBuffer, Roster * roster, std::string & reply) {
+	uint64_t version = rosterVersion.load();
+	if (!executeCommand(inputBuffer, roster, reply)) {
+		return false;
+	}
+	if (inputBuffer.hasVersion()) {
+		if (inputBuffer.hasPut() || inputBuffer.hasDel()) {
+			version = rosterVersion.load();
+		}
+		std::stringstream ss;
+		ss << version;
+		if (ss.str() != inputBuffer.getVersion()) {
+			reply = "!VERSION " + ss.str() + "\n" + reply;
+		}
+	}
+	if (!inputBuffer.getTag().empty()) {
+		reply = inputBuffer.getTag() + " " + reply;
+	}
+	return true;
+}
+
+
+// SOCKET UTILITIES
+
+int getUnboundSockAddr(int soc, sockaddr_in * addr) {
+	ifaddrs * addrs;
+
+	// Step 1: Get ifaddrs for all network interfaces
+	if (getifaddrs(&addrs) < 0) {
+		perror("getifaddrs():");
+		return -1;
+	}
+
+	// Step 2: Select an open outbound AF_INET interface and get its name
+	std::string ifa_name;
+	for (ifaddrs * addrs_temp = addrs; addrs_temp != NULL; addrs_temp = addrs_temp->ifa_next) {
+		if (addrs_temp->ifa_name == NULL) continue;
+		if (!(addrs_temp->ifa_flags & (IFF_UP | IFF_BROADCAST))) continue;
+		if (addrs_temp->ifa_flags & IFF_LOOPBACK) continue;
+		if (addrs_temp->ifa_addr->sa_family != AF_INET) continue;
+		ifa_name = addrs_temp->ifa_name;
+		break;
+	}
+
+	freeifaddrs(addrs);
+	if (!ifa_name.length()) {
+		std::cerr << "Could not find appropriate network device" << std::endl;
+		return -1;
+	}
+
+	// Step 3: Get the IP address for the selected interface
+	ifreq ifr;
+	ifr.ifr_addr.sa_family = AF_INET;
+	strncpy(ifr.ifr_name, ifa_name.c_str(), IFNAMSIZ-1);
+	if (ioctl(soc, SIOCGIFADDR, &ifr) < 0) {
+		perror("ioctl:");
+		return -1;
+	}
+
+	// Step 4: Copy info from ioctl to the provided sockaddr pointer
+	*addr = *(sockaddr_in *)(&ifr.ifr_addr);
+	return 0;
+}
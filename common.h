@@ -0,0 +1,195 @@
+#ifndef COMMON_H
+#define COMMON_H
+
+#include <iostream>
+#include <map>
+#include <netinet/in.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define SELECT_WAIT_SECS 0
+#define SELECT_WAIT_MICROSECS 500000
+
+// STRING UTILITIES
+
+std::string trim(std::string line);
+bool isNumeric(std::string str);
+std::string & tolower(std::string & str);
+
+
+// GROUP MAP
+// student info is stored in this map (groupId -> studentId -> studentName)
+
+typedef std::map<std::string, std::map<std::string, std::string> > GroupMap;
+
+// Reads roster records from an input stream one at a time
+class RosterReader {
+	std::istream & in;
+	std::string groupId;
+
+public:
+	RosterReader(std::istream & in): in(in) {}
+
+	// Read the next student record, skipping group ID declarations
+	// If there are no more records, return false; otherwise return true
+	bool next(std::string & groupId, std::string & studentId, std::string & studentName);
+};
+
+// read stdin input into the groupMap data structure
+std::istream & operator>>(std::istream & in, GroupMap & groupMap);
+
+// Looks up groupMap[groupId][studentId]
+// Returns true and sets studentName if it exists; otherwise returns false
+bool lookup(
+	const GroupMap * groupMap,
+	const std::string & groupId,
+	const std::string & studentId,
+	std::string & studentName
+);
+
+// Formats the reply sent when groupMap[groupId][studentId] does not exist
+std::string notFoundError(const std::string & groupId, const std::string & studentId);
+
+
+// INPUT BUFFER
+// Class for translating text sent by the client into server instructions
+
+class InputBuffer {
+	std::stringstream ss;
+	std::string tag;
+	std::string version;
+	bool versioned;
+	std::string tok;
+	std::string op;
+	std::vector<std::string> get;
+	std::string name;
+	std::vector<std::string> after;		// FIND's cursor: group, student
+
+	bool hasKey() const {
+		return isNumeric(getGroupId()) && isNumeric(getStudentId());
+	}
+
+public:
+	InputBuffer(const std::string & str): ss(str), versioned(false) {}
+
+	// Read the next command (contained in the next line of ss)
+	// If there are no more lines to be read, return false; otherwise return true
+	bool next();
+
+	bool stop() const {
+		return tok == "stop";
+	}
+	bool stopSession() const {
+		return stop() || (tok == "stop_session");
+	}
+	// Admin command answered by the UDP server (see rateLimit.h)
+	bool stats() const {
+		return tok == "stats";
+	}
+	bool hasGet() const {
+		return op == "get" && hasKey();
+	}
+	bool hasPut() const {
+		return op == "put" && hasKey() && !name.empty();
+	}
+	bool hasDel() const {
+		return op == "del" && hasKey();
+	}
+	// Admin command: "TRACE" dumps the request traces, "TRACE <n>" sets
+	// their sampling rate (see trace.h)
+	bool hasTrace() const {
+		return op == "trace" && (get.empty() || (get.size() == 1 && isNumeric(get[0])));
+	}
+	// "FIND [<group>] <prefix> [AFTER <group> <student>]": the students
+	// whose name starts with prefix; AFTER resumes a FIND that replied
+	// "MORE", after the last record it returned
+	bool hasFind() const {
+		return op == "find" && !name.empty();
+	}
+	// "WHERE <student>": the groups the student is in
+	bool hasWhere() const {
+		return op == "where" && get.size() == 1 && isNumeric(get[0]);
+	}
+	bool error() const {
+		return !tok.empty() && !stopSession() && !hasGet() && !hasPut() && !hasDel() && !hasTrace() && !hasFind() && !hasWhere();
+	}
+
+	std::string getGroupId() const {
+		return get.size() == 2 ? get[0] : "";
+	}
+	std::string getStudentId() const {
+		return get.size() == 2 ? get[1] : op == "where" && get.size() == 1 ? get[0] : "";
+	}
+	// The name given to PUT (the rest of the line)
+	std::string getStudentName() const {
+		return name;
+	}
+	// The group FIND is limited to, if any
+	std::string getFindGroup() const {
+		return op == "find" && get.size() == 1 ? get[0] : "";
+	}
+	// The name prefix given to FIND
+	std::string getPrefix() const {
+		return op == "find" ? name : "";
+	}
+	// Whether FIND resumes after a record, and that record's key
+	bool hasCursor() const {
+		return op == "find" && after.size() == 2;
+	}
+	std::string getCursorGroup() const {
+		return hasCursor() ? after[0] : "";
+	}
+	std::string getCursorStudent() const {
+		return hasCursor() ? after[1] : "";
+	}
+	// The sampling rate given to TRACE, if any
+	std::string getTraceEvery() const {
+		return op == "trace" && get.size() == 1 ? get[0] : "";
+	}
+	// The "#<id>" the command started with, if any (echoed with the reply)
+	std::string getTag() const {
+		return tag;
+	}
+	// Whether the command started with "!<version>" (after the tag): the
+	// roster version the client caches replies against (see execute())
+	bool hasVersion() const {
+		return versioned;
+	}
+	std::string getVersion() const {
+		return version;
+	}
+};
+
+
+// REQUEST ENGINE
+// Shared by every transport; STOP and STOP_SESSION are left to the caller
+
+class Roster;
+
+// Largest FIND or WHERE reply: fits in one UDP datagram
+#define FIND_MAX_REPLY_BYTES 60000
+
+// Executes the GET, PUT, DEL, FIND or WHERE (or reports the invalid input) held by inputBuffer
+// Returns true and sets reply if there is a reply to send back; a tagged
+// command's reply starts with its tag, so that clients can match replies
+// that arrive out of order (over UDP)
+//
+// The roster has a version, which every PUT or DEL that changes it bumps;
+// a restarted server starts from a version it never used before. When a
+// command gives a version ("!<version> GET ...") and the roster is at
+// another one, the reply starts with a "!VERSION <version>" line (after
+// the tag): a client caching replies drops what it cached against the old
+// version. A GET's notice gives the version the roster was at before the
+// lookup, an update's the version its own change made
+bool execute(const InputBuffer & inputBuffer, Roster * roster, std::string & reply);
+
+
+// SOCKET UTILITIES
+
+// Provides a sockaddr (complete with IP address)
+// that can be used with AF_INET socket "soc"
+// Returns 0 on success and -1 on error
+int getUnboundSockAddr(int soc, sockaddr_in * addr);
+
+#endif
@@ -0,0 +1,316 @@
+#include <functional>
+#include "concurrentRoster.h"
+
+// Reading threads that can run at once without falling back to the shard lock
+#define MAX_READERS 1024
+
+// Retired memory is only scanned for reclamation once this much is waiting
+#define RECLAIM_BATCH 64
+
+#define INITIAL_BUCKETS 16
+
+// EPOCH DOMAIN
+
+EpochDomain::EpochDomain(size_t maxReaders):
+	slots(maxReaders),
+	slotsInUse(0),
+	epoch(1)
+{
+	for (size_t i = 0; i < slots.size(); i++) {
+		slots[i].epoch.store(0);
+		slots[i].used.store(false);
+	}
+	pthread_mutex_init(&retireLock, NULL);
+}
+
+EpochDomain::~EpochDomain() {
+	for (size_t i = 0; i < retired.size(); i++) {
+		retired[i].destroy(retired[i].ptr);
+	}
+	pthread_mutex_destroy(&retireLock);
+}
+
+int EpochDomain::acquireSlot() {
+	for (size_t i = 0; i < slots.size(); i++) {
+		bool expected = false;
+		if (!slots[i].used.load(std::memory_order_relaxed)
+			&& slots[i].used.compare_exchange_strong(expected, true)) {
+			size_t inUse = slotsInUse.load();
+			while (inUse < i + 1 && !slotsInUse.compare_exchange_weak(inUse, i + 1));
+			return i;
+		}
+	}
+	return -1;
+}
+
+void EpochDomain::releaseSlot(int slot) {
+	slots[slot].epoch.store(0);
+	slots[slot].used.store(false);
+}
+
+void EpochDomain::enter(int slot) {
+	slots[slot].epoch.store(epoch.load());
+	// Pairs with the writer's fetch_add() in retire(): either the writer
+	// sees this slot, or this reader sees the writer's unlink
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EpochDomain::exit(int slot) {
+	slots[slot].epoch.store(0, std::memory_order_release);
+}
+
+void EpochDomain::retire(void * ptr, void (*destroy)(void *)) {
+	pthread_mutex_lock(&retireLock);
+	// Readers that enter from now on announce a later epoch and
+	// can no longer reach ptr
+	Retired r = {epoch.fetch_add(1), destroy, ptr};
+	retired.push_back(r);
+	if (retired.size() >= RECLAIM_BATCH) {
+		reclaim();
+	}
+	pthread_mutex_unlock(&retireLock);
+}
+
+void EpochDomain::reclaim() {
+	uint64_t oldest = UINT64_MAX;
+	size_t inUse = slotsInUse.load();
+	for (size_t i = 0; i < inUse; i++) {
+		uint64_t e = slots[i].epoch.load();
+		if (e && e < oldest) {
+			oldest = e;
+		}
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < retired.size(); i++) {
+		if (retired[i].epoch < oldest) {
+			retired[i].destroy(retired[i].ptr);
+		} else {
+			retired[kept++] = retired[i];
+		}
+	}
+	retired.resize(kept);
+}
+
+static EpochDomain epochDomain(MAX_READERS);
+
+// A reading thread's slot, released when the thread exits
+struct ReaderSlot {
+	int slot;
+
+	ReaderSlot(): slot(epochDomain.acquireSlot()) {}
+	~ReaderSlot() {
+		if (slot >= 0) epochDomain.releaseSlot(slot);
+	}
+};
+
+static thread_local ReaderSlot readerSlot;
+
+
+// CONCURRENT ROSTER
+
+ConcurrentRoster::ConcurrentRoster(): shards(CONCURRENT_ROSTER_SHARDS) {
+	for (size_t i = 0; i < shards.size(); i++) {
+		pthread_mutex_init(&shards[i].writeLock, NULL);
+		shards[i].table.store(newTable(INITIAL_BUCKETS));
+		shards[i].count = 0;
+	}
+}
+
+ConcurrentRoster::~ConcurrentRoster() {
+	for (size_t i = 0; i < shards.size(); i++) {
+		deleteTable(shards[i].table.load());
+		pthread_mutex_destroy(&shards[i].writeLock);
+	}
+}
+
+size_t ConcurrentRoster::hash(const std::string & groupId, const std::string & studentId) {
+	size_t h = std::hash<std::string>()(groupId);
+	return h ^ (std::hash<std::string>()(studentId) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2));
+}
+
+ConcurrentRoster::Table * ConcurrentRoster::newTable(size_t buckets) {
+	Table * table = new Table;
+	table->mask = buckets - 1;
+	table->buckets = new std::atomic<const Node *>[buckets];
+	for (size_t i = 0; i < buckets; i++) {
+		table->buckets[i].store(NULL, std::memory_order_relaxed);
+	}
+	return table;
+}
+
+// Frees a table along with the nodes still linked from it
+void ConcurrentRoster::deleteTable(void * ptr) {
+	Table * table = (Table *) ptr;
+	for (size_t i = 0; i <= table->mask; i++) {
+		const Node * node = table->buckets[i].load(std::memory_order_relaxed);
+		while (node) {
+			const Node * next = node->next;
+			delete node;
+			node = next;
+		}
+	}
+	delete [] table->buckets;
+	delete table;
+}
+
+void ConcurrentRoster::deleteNode(void * node) {
+	delete (Node *) node;
+}
+
+void ConcurrentRoster::load(std::istream & in) {
+	RosterReader reader(in);
+	std::string groupId, studentId, studentName;
+	while (reader.next(groupId, studentId, studentName)) {
+		put(groupId, studentId, studentName);
+	}
+}
+
+bool ConcurrentRoster::find(const std::string & groupId, const std::string & studentId, std::string & studentName) const {
+	size_t h = hash(groupId, studentId);
+	const Shard & shard = shards[h % CONCURRENT_ROSTER_SHARDS];
+	int slot = readerSlot.slot;
+
+	// More threads than slots: read under the writers' lock instead
+	if (slot < 0) {
+		pthread_mutex_lock((pthread_mutex_t *) &shard.writeLock);
+	} else {
+		epochDomain.enter(slot);
+	}
+
+	bool found = false;
+	const Table * table = shard.table.load(std::memory_order_acquire);
+	const Node * node = table->buckets[(h / CONCURRENT_ROSTER_SHARDS) & table->mask].load(std::memory_order_acquire);
+	for (; node; node = node->next) {
+		if (node->studentId == studentId && node->groupId == groupId) {
+			studentName = node->studentName;
+			found = true;
+			break;
+		}
+	}
+
+	if (slot < 0) {
+		pthread_mutex_unlock((pthread_mutex_t *) &shard.writeLock);
+	} else {
+		epochDomain.exit(slot);
+	}
+	return found;
+}
+
+bool ConcurrentRoster::put(const std::string & groupId, const std::string & studentId, const std::string & studentName) {
+	size_t h = hash(groupId, studentId);
+	Shard & shard = shards[h % CONCURRENT_ROSTER_SHARDS];
+	pthread_mutex_lock(&shard.writeLock);
+
+	Table * table = shard.table.load(std::memory_order_relaxed);
+	std::atomic<const Node *> & bucket = table->buckets[(h / CONCURRENT_ROSTER_SHARDS) & table->mask];
+	const Node * head = bucket.load(std::memory_order_relaxed);
+	const Node * old = head;
+	while (old && !(old->studentId == studentId && old->groupId == groupId)) {
+		old = old->next;
+	}
+
+	Node * node = new Node;
+	node->groupId = groupId;
+	node->studentId = studentId;
+	node->studentName = studentName;
+
+	if (!old) {
+		// New student: prepend to the chain
+		node->next = head;
+		bucket.store(node, std::memory_order_release);
+		shard.count++;
+	} else {
+		// Replace the old node, copying the part of the chain in front of it
+		node->next = old->next;
+		std::vector<const Node *> prefix;
+		for (const Node * n = head; n != old; n = n->next) {
+			prefix.push_back(n);
+		}
+		const Node * chain = node;
+		for (size_t i = prefix.size(); i-- > 0; ) {
+			Node * copy = new Node(*prefix[i]);
+			copy->next = chain;
+			chain = copy;
+		}
+		bucket.store(chain, std::memory_order_release);
+
+		for (size_t i = 0; i < prefix.size(); i++) {
+			epochDomain.retire((void *) prefix[i], deleteNode);
+		}
+		epochDomain.retire((void *) old, deleteNode);
+	}
+
+	if (shard.count > table->mask + 1) {
+		grow(shard);
+	}
+	pthread_mutex_unlock(&shard.writeLock);
+	return true;
+}
+
+int ConcurrentRoster::del(const std::string & groupId, const std::string & studentId) {
+	size_t h = hash(groupId, studentId);
+	Shard & shard = shards[h % CONCURRENT_ROSTER_SHARDS];
+	pthread_mutex_lock(&shard.writeLock);
+
+	Table * table = shard.table.load(std::memory_order_relaxed);
+	std::atomic<const Node *> & bucket = table->buckets[(h / CONCURRENT_ROSTER_SHARDS) & table->mask];
+	const Node * head = bucket.load(std::memory_order_relaxed);
+	std::vector<const Node *> prefix;
+	const Node * old = head;
+	while (old && !(old->studentId == studentId && old->groupId == groupId)) {
+		prefix.push_back(old);
+		old = old->next;
+	}
+
+	if (old) {
+		// Unlink the old node, copying the part of the chain in front of it
+		const Node * chain = old->next;
+		for (size_t i = prefix.size(); i-- > 0; ) {
+			Node * copy = new Node(*prefix[i]);
+			copy->next = chain;
+			chain = copy;
+		}
+		bucket.store(chain, std::memory_order_release);
+		shard.count--;
+
+		for (size_t i = 0; i < prefix.size(); i++) {
+			epochDomain.retire((void *) prefix[i], deleteNode);
+		}
+		epochDomain.retire((void *) old, deleteNode);
+	}
+
+	pthread_mutex_unlock(&shard.writeLock);
+	return old != NULL ? 1 : 0;
+}
+
+void ConcurrentRoster::scan(RosterVisitor visit, void * arg) const {
+	for (size_t i = 0; i < shards.size(); i++) {
+		// Under the writers' lock: the chains can't change while visited
+		pthread_mutex_t * lock = (pthread_mutex_t *) &shards[i].writeLock;
+		pthread_mutex_lock(lock);
+		const Table * table = shards[i].table.load(std::memory_order_relaxed);
+		for (size_t b = 0; b <= table->mask; b++) {
+			for (const Node * n = table->buckets[b].load(std::memory_order_relaxed); n; n = n->next) {
+				visit(arg, n->groupId, n->studentId, n->studentName);
+			}
+		}
+		pthread_mutex_unlock(lock);
+	}
+}
+
+// Doubles the shard's table; readers keep using the old one until they are done
+void ConcurrentRoster::grow(Shard & shard) {
+	Table * old = shard.table.load(std::memory_order_relaxed);
+	Table * table = newTable(2 * (old->mask + 1));
+	for (size_t i = 0; i <= old->mask; i++) {
+		for (const Node * n = old->buckets[i].load(std::memory_order_relaxed); n; n = n->next) {
+			std::atomic<const Node *> & bucket = table->buckets[(hash(n->groupId, n->studentId) / CONCURRENT_ROSTER_SHARDS) & table->mask];
+			Node * copy = new Node(*n);
+			copy->next = bucket.load(std::memory_order_relaxed);
+			bucket.store(copy, std::memory_order_relaxed);
+		}
+	}
+	shard.table.store(table, std::memory_order_release);
+	epochDomain.retire(old, deleteTable);
+}
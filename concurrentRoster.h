@@ -0,0 +1,103 @@
+#ifndef CONCURRENT_ROSTER_H
+#define CONCURRENT_ROSTER_H
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "roster.h"
+
+// CONCURRENT ROSTER
+// In-memory roster that can be updated (PUT/DEL) while it is being served
+//
+// Read-copy-update: the index is a set of hash tables (one per shard) whose
+// bucket chains are immutable. A writer takes its shard's lock, builds the
+// changed part of the chain (or a whole new table when growing) and
+// publishes it with a single atomic store. Readers never lock or write
+// shared memory; they only announce the current epoch in their own slot,
+// and a replaced node is freed once every reader that could still be
+// looking at it has left (epoch-based reclamation)
+
+#define CONCURRENT_ROSTER_SHARDS 64
+
+// Epochs announced by the reading threads, and the memory waiting on them
+// (one domain per process; a thread keeps its slot until it exits)
+class EpochDomain {
+	struct Slot {
+		std::atomic<uint64_t> epoch;		// 0 while the thread is not reading
+		std::atomic<bool> used;
+		char pad[64 - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>)];
+	};
+
+	struct Retired {
+		uint64_t epoch;
+		void (*destroy)(void *);
+		void * ptr;
+	};
+
+	std::vector<Slot> slots;
+	std::atomic<size_t> slotsInUse;		// high-water mark of used slots
+	std::atomic<uint64_t> epoch;
+	pthread_mutex_t retireLock;
+	std::vector<Retired> retired;
+
+	void reclaim();
+
+public:
+	EpochDomain(size_t maxReaders);
+	~EpochDomain();
+
+	// Claims a slot for the calling thread; -1 if all slots are taken
+	int acquireSlot();
+	void releaseSlot(int slot);
+
+	// Reading section: nothing unlinked after enter() is freed before exit()
+	void enter(int slot);
+	void exit(int slot);
+
+	// Frees ptr once no reader can reach it (call after unlinking it)
+	void retire(void * ptr, void (*destroy)(void *));
+};
+
+class ConcurrentRoster : public Roster {
+	struct Node {
+		const Node * next;
+		std::string groupId, studentId, studentName;
+	};
+
+	struct Table {
+		size_t mask;
+		std::atomic<const Node *> * buckets;
+	};
+
+	struct Shard {
+		pthread_mutex_t writeLock;
+		std::atomic<Table *> table;
+		size_t count;
+	};
+
+	std::vector<Shard> shards;
+
+	static size_t hash(const std::string & groupId, const std::string & studentId);
+	static Table * newTable(size_t buckets);
+	static void deleteTable(void * table);
+	static void deleteNode(void * node);
+
+	void grow(Shard & shard);
+
+public:
+	ConcurrentRoster();
+	~ConcurrentRoster();
+
+	// Adds the records read from in (before the roster is shared)
+	void load(std::istream & in);
+
+	bool find(const std::string & groupId, const std::string & studentId, std::string & studentName) const;
+	bool writable() const { return true; }
+	bool put(const std::string & groupId, const std::string & studentId, const std::string & studentName);
+	int del(const std::string & groupId, const std::string & studentId);
+	void scan(RosterVisitor visit, void * arg) const;
+};
+
+#endif
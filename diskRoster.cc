@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <queue>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "diskRoster.h"
+
+#define DISK_ROSTER_MAGIC "RSTRDB01"
+#define HEADER_LEN 24
+#define CACHE_SHARDS 16
+
+// RECORD ENCODING
+
+struct Record {
+	std::string groupId, studentId, studentName;
+};
+
+// Orders records by (groupId, studentId), the order of GroupMap
+static int compareKeys(
+	const std::string & groupA, const std::string & studentA,
+	const std::string & groupB, const std::string & studentB
+) {
+	int c = groupA.compare(groupB);
+	return c ? c : studentA.compare(studentB);
+}
+
+static bool recordLess(const Record & a, const Record & b) {
+	return compareKeys(a.groupId, a.studentId, b.groupId, b.studentId) < 0;
+}
+
+template <typename T>
+static void appendInt(std::string & buf, T value) {
+	buf.append((const char *) &value, sizeof(T));
+}
+
+template <typename T>
+static bool readInt(const char *& p, const char * end, T & value) {
+	if (end - p < (long) sizeof(T)) return false;
+	memcpy(&value, p, sizeof(T));
+	p += sizeof(T);
+	return true;
+}
+
+static bool readBytes(const char *& p, const char * end, size_t len, std::string & value) {
+	if ((size_t) (end - p) < len) return false;
+	value.assign(p, len);
+	p += len;
+	return true;
+}
+
+static void appendRecord(std::string & buf, const Record & r) {
+	appendInt<uint16_t>(buf, r.groupId.length());
+	appendInt<uint16_t>(buf, r.studentId.length());
+	appendInt<uint32_t>(buf, r.studentName.length());
+	buf += r.groupId;
+	buf += r.studentId;
+	buf += r.studentName;
+}
+
+static bool readRecord(const char *& p, const char * end, Record & r) {
+	uint16_t groupLen, studentLen;
+	uint32_t nameLen;
+	return readInt(p, end, groupLen) && readInt(p, end, studentLen) && readInt(p, end, nameLen)
+		&& readBytes(p, end, groupLen, r.groupId)
+		&& readBytes(p, end, studentLen, r.studentId)
+		&& readBytes(p, end, nameLen, r.studentName);
+}
+
+// Reads one record from a run file written with appendRecord()
+static bool readRecord(FILE * f, Record & r) {
+	char head[8];
+	if (fread(head, 1, sizeof(head), f) != sizeof(head)) return false;
+	uint16_t groupLen, studentLen;
+	uint32_t nameLen;
+	memcpy(&groupLen, head, 2);
+	memcpy(&studentLen, head + 2, 2);
+	memcpy(&nameLen, head + 4, 4);
+	std::string bytes(groupLen + studentLen + nameLen, '\0');
+	if (bytes.length() && fread(&bytes[0], 1, bytes.length(), f) != bytes.length()) return false;
+	r.groupId.assign(bytes, 0, groupLen);
+	r.studentId.assign(bytes, groupLen, studentLen);
+	r.studentName.assign(bytes, groupLen + studentLen, nameLen);
+	return true;
+}
+
+
+// BLOCK WRITER
+// Packs sorted records into blocks and writes the file layout
+
+class BlockWriter {
+	FILE * f;
+	uint64_t offset;
+	std::string block, firstKey, index;
+	uint64_t blocks;
+
+	void flush() {
+		if (block.empty()) return;
+		fwrite(block.data(), 1, block.length(), f);
+		appendInt<uint64_t>(index, offset);
+		appendInt<uint32_t>(index, block.length());
+		index += firstKey;
+		offset += block.length();
+		blocks++;
+		block.clear();
+	}
+
+public:
+	BlockWriter(FILE * f): f(f), offset(HEADER_LEN), blocks(0) {
+		char header[HEADER_LEN] = {0};
+		fwrite(header, 1, HEADER_LEN, f);
+	}
+
+	void add(const Record & r) {
+		size_t len = 8 + r.groupId.length() + r.studentId.length() + r.studentName.length();
+		if (!block.empty() && block.length() + len > DISK_ROSTER_BLOCK_SIZE) {
+			flush();
+		}
+		if (block.empty()) {
+			firstKey.clear();
+			appendInt<uint16_t>(firstKey, r.groupId.length());
+			appendInt<uint16_t>(firstKey, r.studentId.length());
+			firstKey += r.groupId;
+			firstKey += r.studentId;
+		}
+		appendRecord(block, r);
+	}
+
+	// Returns 0 on success and -1 on error
+	int finish() {
+		flush();
+		fwrite(index.data(), 1, index.length(), f);
+
+		std::string header(DISK_ROSTER_MAGIC);
+		appendInt<uint64_t>(header, offset);
+		appendInt<uint64_t>(header, blocks);
+		fseek(f, 0, SEEK_SET);
+		fwrite(header.data(), 1, header.length(), f);
+		return fflush(f) == 0 && !ferror(f) && fsync(fileno(f)) == 0 ? 0 : -1;
+	}
+};
+
+
+// EXTERNAL SORT
+
+// Sorts records, keeping only the last one read for each key
+// (as GroupMap assignment does)
+static void sortRun(std::vector<Record> & records) {
+	std::stable_sort(records.begin(), records.end(), recordLess);
+	size_t out = 0;
+	for (size_t i = 0; i < records.size(); i++) {
+		if (i + 1 < records.size() && !recordLess(records[i], records[i + 1])) {
+			continue;
+		}
+		if (out != i) {
+			std::swap(records[out], records[i]);
+		}
+		out++;
+	}
+	records.resize(out);
+}
+
+// Merge cursor over one sorted run file
+struct RunCursor {
+	FILE * f;
+	size_t run;							// later runs hold later records
+	Record r;
+};
+
+struct CursorGreater {
+	bool operator()(const RunCursor * a, const RunCursor * b) const {
+		int c = compareKeys(a->r.groupId, a->r.studentId, b->r.groupId, b->r.studentId);
+		return c ? c > 0 : a->run > b->run;
+	}
+};
+
+int DiskRoster::build(std::istream & in, const std::string & path, size_t memBudget) {
+	RosterReader reader(in);
+	std::vector<Record> records;
+	std::vector<std::string> runPaths;
+	size_t bytes = 0;
+	int retCode = 0;
+
+	// Step 1: Sort the input in runs that fit in memBudget
+	Record r;
+	bool more = true;
+	while (more) {
+		more = reader.next(r.groupId, r.studentId, r.studentName);
+		if (more) {
+			bytes += sizeof(Record) + r.groupId.length() + r.studentId.length() + r.studentName.length();
+			records.push_back(r);
+		}
+		if ((more && bytes >= memBudget) || (!more && !runPaths.empty() && !records.empty())) {
+			sortRun(records);
+			char suffix[32];
+			snprintf(suffix, sizeof(suffix), ".run%zu", runPaths.size());
+			runPaths.push_back(path + suffix);
+			FILE * f = fopen(runPaths.back().c_str(), "wb");
+			if (!f) {
+				perror("DiskRoster run:");
+				retCode = -1;
+				break;
+			}
+			std::string buf;
+			for (size_t i = 0; i < records.size(); i++) {
+				appendRecord(buf, records[i]);
+				if (buf.length() > (1 << 20)) {
+					fwrite(buf.data(), 1, buf.length(), f);
+					buf.clear();
+				}
+			}
+			fwrite(buf.data(), 1, buf.length(), f);
+			if (fclose(f) != 0) retCode = -1;
+			records.clear();
+			bytes = 0;
+		}
+	}
+
+	// Step 2: Merge the runs (or write the only one) into blocks
+	std::string tmpPath = path + ".tmp";
+	FILE * out = retCode == 0 ? fopen(tmpPath.c_str(), "w+b") : NULL;
+	if (out) {
+		BlockWriter writer(out);
+		if (runPaths.empty()) {
+			sortRun(records);
+			for (size_t i = 0; i < records.size(); i++) {
+				writer.add(records[i]);
+			}
+		} else {
+			std::priority_queue<RunCursor *, std::vector<RunCursor *>, CursorGreater> heap;
+			std::vector<RunCursor> cursors(runPaths.size());
+			for (size_t i = 0; i < runPaths.size(); i++) {
+				cursors[i].f = fopen(runPaths[i].c_str(), "rb");
+				cursors[i].run = i;
+				if (cursors[i].f && readRecord(cursors[i].f, cursors[i].r)) {
+					heap.push(&cursors[i]);
+				}
+			}
+			while (!heap.empty()) {
+				// Equal keys pop in run order, so the last one popped is the latest
+				RunCursor * c = heap.top();
+				heap.pop();
+				Record winner = c->r;
+				if (readRecord(c->f, c->r)) heap.push(c);
+				while (!heap.empty() && !recordLess(winner, heap.top()->r)) {
+					c = heap.top();
+					heap.pop();
+					winner.studentName = c->r.studentName;
+					if (readRecord(c->f, c->r)) heap.push(c);
+				}
+				writer.add(winner);
+			}
+			for (size_t i = 0; i < cursors.size(); i++) {
+				if (cursors[i].f) fclose(cursors[i].f);
+			}
+		}
+		retCode = writer.finish();
+		if (fclose(out) != 0) retCode = -1;
+		if (retCode == 0 && rename(tmpPath.c_str(), path.c_str()) != 0) {
+			perror("DiskRoster rename:");
+			retCode = -1;
+		}
+	} else {
+		perror("DiskRoster:");
+		retCode = -1;
+	}
+
+	for (size_t i = 0; i < runPaths.size(); i++) {
+		unlink(runPaths[i].c_str());
+	}
+	return retCode;
+}
+
+
+// DISK ROSTER
+
+DiskRoster::~DiskRoster() {
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+int DiskRoster::open(const std::string & path) {
+	fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("DiskRoster open:");
+		return -1;
+	}
+
+	// Step 1: Header
+	char header[HEADER_LEN];
+	uint64_t indexOffset, blocks;
+	const char * p = header + 8;
+	if (pread(fd, header, HEADER_LEN, 0) != HEADER_LEN || memcmp(header, DISK_ROSTER_MAGIC, 8) != 0
+		|| !readInt(p, header + HEADER_LEN, indexOffset) || !readInt(p, header + HEADER_LEN, blocks)) {
+		std::cerr << "DiskRoster: " << path << " is not a roster file" << std::endl;
+		return -1;
+	}
+
+	// Step 2: Load the fence pointers
+	struct stat st;
+	fstat(fd, &st);
+	std::string index(st.st_size - indexOffset, '\0');
+	if (index.length() && pread(fd, &index[0], index.length(), indexOffset) != (ssize_t) index.length()) {
+		perror("DiskRoster index:");
+		return -1;
+	}
+	p = index.data();
+	const char * end = p + index.length();
+	fences.resize(blocks);
+	for (uint64_t i = 0; i < blocks; i++) {
+		uint16_t groupLen, studentLen;
+		Fence & fence = fences[i];
+		if (!readInt(p, end, fence.offset) || !readInt(p, end, fence.length)
+			|| !readInt(p, end, groupLen) || !readInt(p, end, studentLen)
+			|| !readBytes(p, end, groupLen, fence.groupId) || !readBytes(p, end, studentLen, fence.studentId)) {
+			std::cerr << "DiskRoster: " << path << " has a corrupt index" << std::endl;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+bool DiskRoster::find(const std::string & groupId, const std::string & studentId, std::string & studentName) const {
+	// Step 1: The last block whose first key is <= the key
+	size_t lo = 0, hi = fences.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (compareKeys(fences[mid].groupId, fences[mid].studentId, groupId, studentId) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return false;
+	}
+	uint64_t b = lo - 1;
+
+	// Step 2: Get the block from the cache, or read it
+	std::shared_ptr<const std::string> block = cache.get(b);
+	if (!block) {
+		std::string * data = new std::string(fences[b].length, '\0');
+		if (pread(fd, &(*data)[0], data->length(), fences[b].offset) != (ssize_t) data->length()) {
+			delete data;
+			return false;
+		}
+		block.reset(data);
+		cache.put(b, block);
+	}
+
+	// Step 3: Scan the block
+	const char * p = block->data();
+	const char * end = p + block->length();
+	Record r;
+	while (p < end && readRecord(p, end, r)) {
+		int c = compareKeys(r.groupId, r.studentId, groupId, studentId);
+		if (c == 0) {
+			studentName = r.studentName;
+			return true;
+		}
+		if (c > 0) {
+			break;
+		}
+	}
+	return false;
+}
+
+void DiskRoster::scan(RosterVisitor visit, void * arg) const {
+	std::string block;
+	Record r;
+	for (size_t b = 0; b < fences.size(); b++) {
+		block.resize(fences[b].length);
+		if (pread(fd, &block[0], block.length(), fences[b].offset) != (ssize_t) block.length()) {
+			perror("DiskRoster scan:");
+			return;
+		}
+		const char * p = block.data();
+		const char * end = p + block.length();
+		while (p < end && readRecord(p, end, r)) {
+			visit(arg, r.groupId, r.studentId, r.studentName);
+		}
+	}
+}
+
+
+// BLOCK CACHE
+
+BlockCache::BlockCache(size_t budget): shards(CACHE_SHARDS), shardBudget(budget / CACHE_SHARDS) {
+	for (size_t i = 0; i < shards.size(); i++) {
+		pthread_mutex_init(&shards[i].m, NULL);
+		shards[i].bytes = 0;
+	}
+}
+
+BlockCache::~BlockCache() {
+	for (size_t i = 0; i < shards.size(); i++) {
+		pthread_mutex_destroy(&shards[i].m);
+	}
+}
+
+std::shared_ptr<const std::string> BlockCache::get(uint64_t block) {
+	Shard & shard = shards[block % shards.size()];
+	std::shared_ptr<const std::string> data;
+	pthread_mutex_lock(&shard.m);
+	if (shard.blocks.count(block)) {
+		// Move to the front (most recently used)
+		shard.lru.splice(shard.lru.begin(), shard.lru, shard.blocks[block]);
+		data = shard.lru.front().second;
+	}
+	pthread_mutex_unlock(&shard.m);
+	return data;
+}
+
+void BlockCache::put(uint64_t block, const std::shared_ptr<const std::string> & data) {
+	Shard & shard = shards[block % shards.size()];
+	pthread_mutex_lock(&shard.m);
+	if (!shard.blocks.count(block) && data->length() <= shardBudget) {
+		shard.lru.push_front(std::make_pair(block, data));
+		shard.blocks[block] = shard.lru.begin();
+		shard.bytes += data->length();
+
+		// Evict the least recently used blocks over the budget
+		while (shard.bytes > shardBudget) {
+			shard.bytes -= shard.lru.back().second->length();
+			shard.blocks.erase(shard.lru.back().first);
+			shard.lru.pop_back();
+		}
+	}
+	pthread_mutex_unlock(&shard.m);
+}
@@ -0,0 +1,79 @@
+#ifndef DISK_ROSTER_H
+#define DISK_ROSTER_H
+
+#include <list>
+#include <memory>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "roster.h"
+
+// DISK ROSTER
+// Roster kept in a sorted, block-indexed file, for datasets larger than RAM
+//
+// File layout:
+//   header   "RSTRDB01", u64 index offset, u64 block count
+//   blocks   records sorted by (groupId, studentId), each encoded as
+//            u16 groupLen, u16 studentLen, u32 nameLen, then the bytes;
+//            a block holds about BLOCK_SIZE bytes and never splits a record
+//   index    per block: u64 offset, u32 length, then its first key
+//            (u16 groupLen, u16 studentLen, bytes)
+//
+// Only the index (the first key of every block, used as fence pointers)
+// lives in memory. A lookup binary searches the fences and scans the one
+// block that may hold the key: a cache miss costs exactly one pread()
+
+#define DISK_ROSTER_BLOCK_SIZE 4096
+
+// Sharded LRU cache of blocks, bounded by a memory budget
+class BlockCache {
+	struct Shard {
+		pthread_mutex_t m;
+		std::list<std::pair<uint64_t, std::shared_ptr<const std::string> > > lru;
+		std::unordered_map<uint64_t, std::list<std::pair<uint64_t, std::shared_ptr<const std::string> > >::iterator> blocks;
+		size_t bytes;
+	};
+	std::vector<Shard> shards;
+	size_t shardBudget;
+
+public:
+	BlockCache(size_t budget);
+	~BlockCache();
+
+	std::shared_ptr<const std::string> get(uint64_t block);
+	void put(uint64_t block, const std::shared_ptr<const std::string> & data);
+};
+
+class DiskRoster : public Roster {
+	struct Fence {
+		std::string groupId, studentId;	// first key in the block
+		uint64_t offset;
+		uint32_t length;
+	};
+
+	int fd;
+	std::vector<Fence> fences;
+	mutable BlockCache cache;
+
+public:
+	DiskRoster(size_t cacheBytes): fd(-1), cache(cacheBytes) {}
+	~DiskRoster();
+
+	// Writes the records read from in to a roster file at path, sorting them
+	// externally in runs of at most memBudget bytes
+	// Returns 0 on success and -1 on error
+	static int build(std::istream & in, const std::string & path, size_t memBudget);
+
+	// Opens a roster file written by build() and loads its index
+	// Returns 0 on success and -1 on error
+	int open(const std::string & path);
+
+	bool find(const std::string & groupId, const std::string & studentId, std::string & studentName) const;
+
+	// Reads every block in turn (bypassing the cache)
+	void scan(RosterVisitor visit, void * arg) const;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <functional>
+#include <string.h>
+#include "flatRoster.h"
+
+#define FLAT_TAG_SHIFT 48
+#define FLAT_OFFSET_MASK ((1ull << FLAT_TAG_SHIFT) - 1)
+#define FLAT_HEADER_BYTES (3 * sizeof(uint32_t))
+#define FLAT_REPLACED (1u << 31)			// in the group length of a replaced record
+#define FLAT_CHUNK_BYTES (1 << 20)			// records packed while reading, per chunk
+
+static size_t hash(const std::string & groupId, const std::string & studentId) {
+	size_t h = std::hash<std::string>()(groupId);
+	return h ^ (std::hash<std::string>()(studentId) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2));
+}
+
+static size_t recordBytes(size_t groupLen, size_t studentLen, size_t nameLen) {
+	return (FLAT_HEADER_BYTES + groupLen + studentLen + nameLen + 7) & ~(size_t) 7;
+}
+
+
+// FLAT ROSTER
+
+int FlatRoster::build(std::istream & in, HugePages hugePages, int node) {
+	// Step 1: Pack the records as they are read, in chunks, so that the
+	// roster is never held twice over
+	std::vector<std::string> chunks(1);
+	RosterReader reader(in);
+	std::string groupId, studentId, studentName;
+	size_t records = 0;
+	arenaBytes = 0;
+	while (reader.next(groupId, studentId, studentName)) {
+		uint32_t lengths[3] = {(uint32_t) groupId.length(), (uint32_t) studentId.length(), (uint32_t) studentName.length()};
+		size_t length = recordBytes(lengths[0], lengths[1], lengths[2]);
+		if (!chunks.back().empty() && chunks.back().length() + length > FLAT_CHUNK_BYTES) {
+			chunks.push_back(std::string());
+		}
+		std::string & chunk = chunks.back();
+		if (chunk.empty()) {
+			chunk.reserve(FLAT_CHUNK_BYTES);
+		}
+		chunk.append((const char *) lengths, FLAT_HEADER_BYTES);
+		chunk += groupId;
+		chunk += studentId;
+		chunk += studentName;
+		chunk.append(length - FLAT_HEADER_BYTES - lengths[0] - lengths[1] - lengths[2], '\0');
+		arenaBytes += length;
+		records++;
+	}
+
+	// Step 2: Size the table (a power of two, at most half full), and move
+	// the chunks into the arena, freeing each once it is copied
+	size_t slotCount = 16;
+	while (slotCount < 2 * records) {
+		slotCount *= 2;
+	}
+	mask = slotCount - 1;
+	base = (char *) mapRegion(bytes(), hugePages, node, mapped);
+	if (base == NULL) {
+		return -1;
+	}
+	char * arenaStart = base + slotCount * sizeof(uint64_t);
+	size_t offset = 0;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		memcpy(arenaStart + offset, chunks[i].data(), chunks[i].length());
+		offset += chunks[i].length();
+		std::string().swap(chunks[i]);
+	}
+
+	// Step 3: A slot for each record; a key read again replaces the record
+	// read before it, as it would in a GroupMap
+	uint64_t * table = (uint64_t *) base;
+	count = 0;
+	for (offset = 0; offset < arenaBytes; ) {
+		char * r = arenaStart + offset;
+		uint32_t lengths[3];
+		memcpy(lengths, r, FLAT_HEADER_BYTES);
+		const char * group = r + FLAT_HEADER_BYTES;
+		const char * student = group + lengths[0];
+
+		size_t h = hash(std::string(group, lengths[0]), std::string(student, lengths[1]));
+		uint64_t tag = (uint64_t) (h >> FLAT_TAG_SHIFT);
+		size_t i = h & mask;
+		for (; table[i]; i = (i + 1) & mask) {
+			if (table[i] >> FLAT_TAG_SHIFT != tag) {
+				continue;
+			}
+			char * old = arenaStart + (table[i] & FLAT_OFFSET_MASK) - 1;
+			uint32_t oldLengths[3];
+			memcpy(oldLengths, old, FLAT_HEADER_BYTES);
+			if (oldLengths[0] == lengths[0] && oldLengths[1] == lengths[1]
+				&& memcmp(old + FLAT_HEADER_BYTES, group, lengths[0] + lengths[1]) == 0) {
+				oldLengths[0] |= FLAT_REPLACED;
+				memcpy(old, oldLengths, FLAT_HEADER_BYTES);
+				count--;
+				break;
+			}
+		}
+		table[i] = (tag << FLAT_TAG_SHIFT) | (offset + 1);
+		count++;
+		offset += recordBytes(lengths[0], lengths[1], lengths[2]);
+	}
+	return 0;
+}
+
+int FlatRoster::copy(const FlatRoster & from, HugePages hugePages, int node) {
+	mask = from.mask;
+	count = from.count;
+	arenaBytes = from.arenaBytes;
+	base = (char *) mapRegion(bytes(), hugePages, node, mapped);
+	if (base == NULL) {
+		return -1;
+	}
+	memcpy(base, from.base, bytes());
+	return 0;
+}
+
+bool FlatRoster::find(const std::string & groupId, const std::string & studentId, std::string & studentName) const {
+	const uint64_t * table = slots();
+	size_t h = hash(groupId, studentId);
+	uint64_t tag = (uint64_t) (h >> FLAT_TAG_SHIFT);
+	for (size_t i = h & mask; table[i]; i = (i + 1) & mask) {
+		if (table[i] >> FLAT_TAG_SHIFT != tag) {
+			continue;
+		}
+		const char * r = arena() + (table[i] & FLAT_OFFSET_MASK) - 1;
+		uint32_t lengths[3];
+		memcpy(lengths, r, FLAT_HEADER_BYTES);
+		r += FLAT_HEADER_BYTES;
+		if (lengths[0] == groupId.length() && lengths[1] == studentId.length()
+			&& memcmp(r, groupId.data(), lengths[0]) == 0
+			&& memcmp(r + lengths[0], studentId.data(), lengths[1]) == 0) {
+			studentName.assign(r + lengths[0] + lengths[1], lengths[2]);
+			return true;
+		}
+	}
+	return false;
+}
+
+void FlatRoster::scan(RosterVisitor visit, void * arg) const {
+	const char * records = arena();
+	for (size_t offset = 0; offset < arenaBytes; ) {
+		uint32_t lengths[3];
+		memcpy(lengths, records + offset, FLAT_HEADER_BYTES);
+		bool replaced = lengths[0] & FLAT_REPLACED;
+		lengths[0] &= ~FLAT_REPLACED;
+		const char * r = records + offset + FLAT_HEADER_BYTES;
+		if (!replaced) {
+			visit(arg, std::string(r, lengths[0]), std::string(r + lengths[0], lengths[1]), std::string(r + lengths[0] + lengths[1], lengths[2]));
+		}
+		offset += recordBytes(lengths[0], lengths[1], lengths[2]);
+	}
+}
+
+
+// REPLICATED ROSTER
+
+ReplicatedRoster::~ReplicatedRoster() {
+	for (size_t i = 0; i < replicas.size(); i++) {
+		delete replicas[i];
+	}
+}
+
+int ReplicatedRoster::build(std::istream & in, HugePages hugePages) {
+	bindServingThreads();
+	int nodes = numaNodeCount();
+	for (int node = 0; node < nodes; node++) {
+		FlatRoster * replica = new FlatRoster();
+		replicas.push_back(replica);
+		int built = node == 0
+			? replica->build(in, hugePages, node)
+			: replica->copy(*replicas[0], hugePages, node);
+		if (built < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+const FlatRoster * ReplicatedRoster::local() const {
+	// A thread that was not bound at its start reads the copy of wherever it runs now
+	int node = boundNumaNode();
+	if (node < 0) {
+		node = currentNumaNode();
+	}
+	return replicas[(size_t) node < replicas.size() ? node : 0];
+}
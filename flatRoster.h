@@ -0,0 +1,100 @@
+#ifndef FLAT_ROSTER_H
+#define FLAT_ROSTER_H
+
+#include <stddef.h>
+#include <istream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "memPlacement.h"
+#include "roster.h"
+
+// FLAT ROSTER
+// Read-only in-memory roster laid out in a single mapping, so that where
+// it lives can be chosen (see memPlacement.h): on huge pages, on a NUMA node
+//
+// The mapping holds an open addressing hash table of 64-bit slots (at most
+// half full), then an arena of records in input order:
+//   slot    (hash tag << 48) | (arena offset + 1), 0 if empty; the tag (the
+//           top 16 bits of the key's hash) rejects most other keys without
+//           touching their record
+//   record  group, student and name lengths (uint32_t each), then the
+//           three strings, padded to 8 bytes; the top bit of the group
+//           length marks a record replaced by a later one with its key
+// Offsets are relative to the mapping, so a copy is a memcpy()
+
+class FlatRoster : public Roster {
+	char * base;
+	size_t mapped;
+	size_t mask;						// slots - 1
+	size_t count;
+	size_t arenaBytes;
+
+	const uint64_t * slots() const {
+		return (const uint64_t *) base;
+	}
+	const char * arena() const {
+		return base + (mask + 1) * sizeof(uint64_t);
+	}
+
+public:
+	FlatRoster(): base(NULL), mapped(0), mask(0), count(0), arenaBytes(0) {}
+	~FlatRoster() {
+		unmapRegion(base, mapped);
+	}
+
+	// Lays out the records read from in, in memory placed as asked (node -1:
+	// anywhere); a key read twice keeps its last name, as in a GroupMap
+	// Returns 0 on success and -1 on error
+	int build(std::istream & in, HugePages hugePages, int node);
+
+	// Copies from into memory placed as asked
+	// Returns 0 on success and -1 on error
+	int copy(const FlatRoster & from, HugePages hugePages, int node);
+
+	bool find(const std::string & groupId, const std::string & studentId, std::string & studentName) const;
+	void scan(RosterVisitor visit, void * arg) const;
+
+	size_t size() const {
+		return count;
+	}
+	// Bytes of the table and the arena
+	size_t bytes() const {
+		return (mask + 1) * sizeof(uint64_t) + arenaBytes;
+	}
+};
+
+
+// REPLICATED ROSTER
+// One FlatRoster per NUMA node, each in its node's memory. Serving threads
+// are bound to the node they start on (see bindToLocalNode()), and read
+// that node's copy only
+
+class ReplicatedRoster : public Roster {
+	std::vector<FlatRoster *> replicas;
+
+	const FlatRoster * local() const;
+
+public:
+	~ReplicatedRoster();
+
+	// Builds a copy of the records read from in on every node
+	// Returns 0 on success and -1 on error
+	int build(std::istream & in, HugePages hugePages);
+
+	bool find(const std::string & groupId, const std::string & studentId, std::string & studentName) const {
+		return local()->find(groupId, studentId, studentName);
+	}
+	void scan(RosterVisitor visit, void * arg) const {
+		replicas[0]->scan(visit, arg);
+	}
+
+	size_t copies() const {
+		return replicas.size();
+	}
+	const FlatRoster * replica(size_t node) const {
+		return replicas[node];
+	}
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include <errno.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "handoff.h"
+
+// Most sockets a server hands off (TCP and UDP listeners, one per reactor)
+#define MAX_HANDOFF_FDS 256
+
+static int unixAddr(const std::string & path, sockaddr_un * addr) {
+	memset(addr, 0, sizeof(sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (path.length() >= sizeof(addr->sun_path)) {
+		std::cerr << "Handoff path too long: " << path << std::endl;
+		return -1;
+	}
+	strcpy(addr->sun_path, path.c_str());
+	return 0;
+}
+
+
+// FD PASSING
+
+int sendFds(int sockfd, const std::vector<int> & fds) {
+	if (fds.empty() || fds.size() > MAX_HANDOFF_FDS) {
+		return -1;
+	}
+
+	// At least one byte of data must accompany the descriptors
+	char count = (char) fds.size();
+	iovec iov = {&count, 1};
+	std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &control[0];
+	msg.msg_controllen = control.size();
+
+	cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+	memcpy(CMSG_DATA(cmsg), &fds[0], sizeof(int) * fds.size());
+
+	if (sendmsg(sockfd, &msg, MSG_NOSIGNAL) < 0) {
+		perror("sendmsg:");
+		return -1;
+	}
+	return 0;
+}
+
+int recvFds(int sockfd, std::vector<int> & fds, unsigned int maxFds) {
+	char count;
+	iovec iov = {&count, 1};
+	std::vector<char> control(CMSG_SPACE(sizeof(int) * maxFds));
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &control[0];
+	msg.msg_controllen = control.size();
+
+	if (recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC) <= 0) {
+		return -1;
+	}
+
+	fds.clear();
+	for (cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (size_t i = 0; i < n; i++) {
+				int fd;
+				memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				fds.push_back(fd);
+			}
+		}
+	}
+	if (msg.msg_flags & MSG_CTRUNC) {
+		std::cerr << "recvFds(): too many descriptors" << std::endl;
+		for (unsigned int i = 0; i < fds.size(); i++) close(fds[i]);
+		fds.clear();
+		return -1;
+	}
+	return fds.empty() ? -1 : 0;
+}
+
+
+// NEW SERVER
+
+int takeover(const std::string & path, std::vector<int> & fds, unsigned int maxFds) {
+	sockaddr_un addr;
+	if (unixAddr(path, &addr) < 0) {
+		return -1;
+	}
+
+	int peer = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (peer < 0) {
+		perror("Socket:");
+		return -1;
+	}
+	if (connect(peer, (const sockaddr *) &addr, sizeof(addr)) < 0) {
+		// Nobody to take over from, this is a fresh start
+		close(peer);
+		return -1;
+	}
+	if (recvFds(peer, fds, maxFds) < 0) {
+		std::cerr << "Handoff from " << path << " failed" << std::endl;
+		close(peer);
+		return -1;
+	}
+	return peer;
+}
+
+int socketType(int fd) {
+	int type;
+	socklen_t len = sizeof(type);
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0) {
+		return -1;
+	}
+	return type;
+}
+
+void handoffReady(int peer) {
+	char ready = 1;
+	if (send(peer, &ready, 1, MSG_NOSIGNAL) < 0) {
+		perror("Handoff:");
+	}
+	close(peer);
+}
+
+
+// OLD SERVER
+
+HandoffListener::~HandoffListener() {
+	if (peer >= 0) {
+		close(peer);
+	}
+	if (listenSoc >= 0) {
+		close(listenSoc);
+		// After a handoff the path belongs to the new server
+		if (!handedOff) {
+			unlink(path.c_str());
+		}
+	}
+}
+
+int HandoffListener::listen() {
+	sockaddr_un addr;
+	if (unixAddr(path, &addr) < 0) {
+		return -1;
+	}
+
+	listenSoc = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenSoc < 0) {
+		perror("Socket:");
+		return -1;
+	}
+	unlink(path.c_str());
+	if (bind(listenSoc, (const sockaddr *) &addr, sizeof(addr)) < 0 || ::listen(listenSoc, 1) < 0) {
+		perror("Handoff listen:");
+		close(listenSoc);
+		listenSoc = -1;
+		return -1;
+	}
+	return 0;
+}
+
+int HandoffListener::fill(fd_set * fdSet, int maxFd) const {
+	int fd = peer >= 0 ? peer : listenSoc;
+	if (fd < 0 || handedOff) {
+		return maxFd;
+	}
+	FD_SET(fd, fdSet);
+	return fd > maxFd ? fd : maxFd;
+}
+
+bool HandoffListener::handle(const fd_set * fdSet) {
+	if (handedOff) {
+		return true;
+	}
+
+	// Step 1: A new server connected, hand it our sockets (we keep serving)
+	if (peer < 0) {
+		if (listenSoc < 0 || !FD_ISSET(listenSoc, fdSet)) {
+			return false;
+		}
+		peer = accept4(listenSoc, NULL, NULL, SOCK_CLOEXEC);
+		if (peer < 0) {
+			return false;
+		}
+		if (sendFds(peer, fds) < 0) {
+			close(peer);
+			peer = -1;
+		}
+		return false;
+	}
+
+	// Step 2: Wait for the new server to be ready
+	if (!FD_ISSET(peer, fdSet)) {
+		return false;
+	}
+	char ready;
+	int l = recv(peer, &ready, 1, 0);
+	close(peer);
+	peer = -1;
+	if (l != 1) {
+		// The new server went away before serving, carry on
+		std::cerr << "Handoff aborted" << std::endl;
+		return false;
+	}
+	handedOff = true;
+	return true;
+}
@@ -0,0 +1,76 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <string>
+#include <sys/select.h>
+#include <vector>
+
+// HANDOFF
+// Zero-downtime upgrades: a running server listens on a Unix socket (the
+// handoff path) and passes its bound TCP/UDP sockets to a newly started
+// server with SCM_RIGHTS. Both processes serve until the new one has
+// loaded its roster and says it is ready; the old one then stops
+// accepting, drains its existing connections and exits. The port never
+// changes and no connection is refused. Not available with --wal: the old
+// server keeps logging writes that the new one, which has already replayed
+// the log, would lose.
+//
+// make handoff-test upgrades a TCP server twice under load and checks
+// that no request failed.
+//
+// Exchange on the handoff path:
+//   new -> old    connect()
+//   old -> new    the serving sockets (SCM_RIGHTS)
+//   new -> old    one byte once it is ready to serve
+
+// Sends fds over the Unix socket sockfd
+// Returns 0 on success and -1 on error
+int sendFds(int sockfd, const std::vector<int> & fds);
+
+// Receives up to maxFds descriptors sent with sendFds()
+// Returns 0 on success and -1 on error
+int recvFds(int sockfd, std::vector<int> & fds, unsigned int maxFds);
+
+// Takes over the sockets of the server listening for handoffs on path
+// On success returns the connection to the old server (pass it to
+// handoffReady()) and fills fds; returns -1 if there is no server to
+// take over from
+int takeover(const std::string & path, std::vector<int> & fds, unsigned int maxFds);
+
+// Returns the SO_TYPE of a socket (SOCK_STREAM, SOCK_DGRAM), or -1
+int socketType(int fd);
+
+// Tells the old server that the new one is serving, and closes peer
+void handoffReady(int peer);
+
+// The old server's side of a handoff
+class HandoffListener {
+	std::string path;
+	std::vector<int> fds;				// sockets handed to the new server
+	int listenSoc;						// bound to path
+	int peer;							// connected new server, if any
+	bool handedOff;
+
+public:
+	HandoffListener(const std::string & path, const std::vector<int> & fds):
+		path(path),
+		fds(fds),
+		listenSoc(-1),
+		peer(-1),
+		handedOff(false)
+	{}
+	~HandoffListener();
+
+	// Start listening on path, replacing any stale socket there
+	// Returns 0 on success and -1 on error
+	int listen();
+
+	// Add the handoff sockets to fdSet, returns the highest descriptor
+	int fill(fd_set * fdSet, int maxFd) const;
+
+	// Serve the handoff sockets that select() reported in fdSet
+	// Returns true once a new server has taken over and is ready
+	bool handle(const fd_set * fdSet);
+};
+
+#endif
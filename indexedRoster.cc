@@ -0,0 +1,194 @@
+#include <functional>
+#include <iostream>
+#include <time.h>
+#include "indexedRoster.h"
+
+static long millisSince(const timespec & start) {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+// INDEXED ROSTER
+
+struct Collector {
+	Roster * engine;
+	size_t limit;
+	std::vector<RosterRecord> * records;
+	bool more;
+};
+
+struct GroupCollector {
+	Roster * engine;
+	std::string studentId;
+	std::vector<RosterRecord> * records;
+	size_t bytes;
+	bool more;
+};
+
+IndexedRoster::IndexedRoster(Roster * engine, size_t findLimit, bool studentIndex):
+	engine(engine),
+	findLimit(findLimit),
+	studentIndex(studentIndex)
+{
+	for (int i = 0; i < INDEX_STRIPES; i++) {
+		pthread_mutex_init(&stripes[i], NULL);
+	}
+
+	// Step 1: Feed every record to the indexes
+	timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	engine->scan(indexRecord, this);
+	std::cerr << "Indexes: scanned the roster in " << millisSince(start) << " ms" << std::endl;
+
+	// Step 2: Sort them
+	if (findLimit) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		names.finish();
+		std::cerr << "Name index: " << names.size() << " students, " << (names.memoryBytes() >> 10)
+			<< " KB, sorted in " << millisSince(start) << " ms" << std::endl;
+	}
+	if (studentIndex) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		students.finish();
+		std::cerr << "Student index: " << students.size() << " students in " << students.groupCount() << " groups, "
+			<< (students.memoryBytes() >> 10) << " KB, built in " << millisSince(start) << " ms" << std::endl;
+	}
+}
+
+void IndexedRoster::indexRecord(void * arg, const std::string & groupId, const std::string & studentId, const std::string & studentName) {
+	IndexedRoster * roster = (IndexedRoster *) arg;
+	if (roster->findLimit) {
+		roster->names.add(groupId, studentId, studentName);
+	}
+	if (roster->studentIndex) {
+		roster->students.add(groupId, studentId);
+	}
+}
+
+IndexedRoster::~IndexedRoster() {
+	delete engine;
+	for (int i = 0; i < INDEX_STRIPES; i++) {
+		pthread_mutex_destroy(&stripes[i]);
+	}
+}
+
+pthread_mutex_t * IndexedRoster::stripe(const std::string & groupId, const std::string & studentId) {
+	size_t h = std::hash<std::string>()(groupId) * 31 + std::hash<std::string>()(studentId);
+	return &stripes[h % INDEX_STRIPES];
+}
+
+bool IndexedRoster::put(const std::string & groupId, const std::string & studentId, const std::string & studentName) {
+	pthread_mutex_t * m = stripe(groupId, studentId);
+	pthread_mutex_lock(m);
+	// A rename takes the old name out of the name index
+	std::string old;
+	bool renamed = findLimit && engine->find(groupId, studentId, old) && old != studentName;
+	if (!engine->put(groupId, studentId, studentName)) {
+		pthread_mutex_unlock(m);
+		return false;
+	}
+	if (findLimit) {
+		if (renamed) {
+			names.remove(groupId, studentId, old);
+		}
+		names.insert(groupId, studentId, studentName);
+	}
+	if (studentIndex) {
+		students.insert(groupId, studentId);
+	}
+	pthread_mutex_unlock(m);
+	return true;
+}
+
+int IndexedRoster::del(const std::string & groupId, const std::string & studentId) {
+	pthread_mutex_t * m = stripe(groupId, studentId);
+	pthread_mutex_lock(m);
+	std::string old;
+	bool named = findLimit && engine->find(groupId, studentId, old);
+	int deleted = engine->del(groupId, studentId);
+	if (deleted > 0 && named) {
+		names.remove(groupId, studentId, old);
+	}
+	if (deleted > 0 && studentIndex) {
+		students.remove(groupId, studentId);
+	}
+	pthread_mutex_unlock(m);
+	return deleted;
+}
+
+bool IndexedRoster::collect(void * arg, const std::string & groupId, const std::string & studentId, const std::string & name, bool exact) {
+	Collector * c = (Collector *) arg;
+	RosterRecord record = {groupId, studentId, name};
+
+	// On a writable roster the student may have been deleted or renamed
+	// since it was indexed; the engine has the last word
+	if (!exact || c->engine->writable()) {
+		if (!c->engine->find(groupId, studentId, record.studentName)) {
+			return true;
+		}
+		std::string current = record.studentName, indexed = name;
+		if (tolower(current) != tolower(indexed)) {
+			return true;
+		}
+	}
+
+	if (c->records->size() == c->limit) {
+		c->more = true;
+		return false;
+	}
+	c->records->push_back(record);
+	return true;
+}
+
+int IndexedRoster::findByName(const std::string & groupId, const std::string & prefix, const RosterRecord * after, std::vector<RosterRecord> & records) const {
+	if (!findLimit) {
+		return -1;
+	}
+	std::string lowered = prefix;
+	tolower(lowered);
+
+	// The cursor is placed by the student's current name, as it was returned
+	std::string afterName;
+	if (after != NULL) {
+		if (!engine->find(after->groupId, after->studentId, afterName)) {
+			return -2;
+		}
+		tolower(afterName);
+		if (afterName.compare(0, lowered.length(), lowered) != 0) {
+			return -2;
+		}
+	}
+
+	Collector c = {engine, findLimit, &records, false};
+	RosterRecord cursor = {after != NULL ? after->groupId : "", after != NULL ? after->studentId : "", afterName};
+	names.search(groupId, lowered, after != NULL ? &cursor : NULL, collect, &c);
+	return c.more ? 1 : 0;
+}
+
+bool IndexedRoster::collectGroup(void * arg, const std::string & groupId) {
+	GroupCollector * c = (GroupCollector *) arg;
+	RosterRecord record = {groupId, c->studentId, ""};
+
+	// The name comes from the engine, which also drops deleted students;
+	// stop once the records fill a reply
+	if (!c->engine->find(groupId, c->studentId, record.studentName)) {
+		return true;
+	}
+	c->bytes += groupId.length() + c->studentId.length() + record.studentName.length() + 3;
+	if (c->bytes > FIND_MAX_REPLY_BYTES) {
+		c->more = true;
+		return false;
+	}
+	c->records->push_back(record);
+	return true;
+}
+
+int IndexedRoster::whereStudent(const std::string & studentId, std::vector<RosterRecord> & records) const {
+	if (!studentIndex) {
+		return -1;
+	}
+	GroupCollector c = {engine, studentId, &records, 0, false};
+	students.search(studentId, collectGroup, &c);
+	return c.more ? 1 : 0;
+}
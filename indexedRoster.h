@@ -0,0 +1,58 @@
+#ifndef INDEXED_ROSTER_H
+#define INDEXED_ROSTER_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "nameIndex.h"
+#include "roster.h"
+#include "studentIndex.h"
+
+// INDEXED ROSTER
+// A roster with secondary indexes: forwards everything to the engine it
+// owns, and answers findByName() (FIND, see nameIndex.h) and whereStudent()
+// (WHERE, see studentIndex.h). The indexes asked for are built in one scan
+// of the engine at startup; their size and build time go to stderr
+//
+// A PUT or DEL updates the engine and the indexes under a lock striped by
+// key (INDEX_STRIPES of them), so that changes to one student reach both
+// in the same order while changes to others go on in parallel
+
+#define INDEX_STRIPES 64
+
+class IndexedRoster : public Roster {
+	Roster * engine;
+	NameIndex names;
+	StudentIndex students;
+	size_t findLimit;
+	bool studentIndex;
+	pthread_mutex_t stripes[INDEX_STRIPES];
+
+	pthread_mutex_t * stripe(const std::string & groupId, const std::string & studentId);
+	static void indexRecord(void * arg, const std::string & groupId, const std::string & studentId, const std::string & studentName);
+	static bool collect(void * arg, const std::string & groupId, const std::string & studentId, const std::string & name, bool exact);
+	static bool collectGroup(void * arg, const std::string & groupId);
+
+public:
+	// Builds the indexes from engine->scan(); the name index only if
+	// findLimit (the most records per FIND) isn't 0, the student index
+	// only if studentIndex
+	IndexedRoster(Roster * engine, size_t findLimit, bool studentIndex);
+	~IndexedRoster();
+
+	bool find(const std::string & groupId, const std::string & studentId, std::string & studentName) const {
+		return engine->find(groupId, studentId, studentName);
+	}
+	bool writable() const {
+		return engine->writable();
+	}
+	bool put(const std::string & groupId, const std::string & studentId, const std::string & studentName);
+	int del(const std::string & groupId, const std::string & studentId);
+	void scan(RosterVisitor visit, void * arg) const {
+		engine->scan(visit, arg);
+	}
+	int findByName(const std::string & groupId, const std::string & prefix, const RosterRecord * after, std::vector<RosterRecord> & records) const;
+	int whereStudent(const std::string & studentId, std::vector<RosterRecord> & records) const;
+};
+
+#endif
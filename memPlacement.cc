@@ -0,0 +1,184 @@
+#include <fstream>
+#include <iostream>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#include "memPlacement.h"
+
+#define HUGE_PAGE_BYTES (2 << 20)
+
+bool parseHugePages(const std::string & str, HugePages & hugePages) {
+	if (str == "none") {
+		hugePages = HUGE_PAGES_NONE;
+	} else if (str == "thp") {
+		hugePages = HUGE_PAGES_THP;
+	} else if (str == "explicit") {
+		hugePages = HUGE_PAGES_EXPLICIT;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+const char * hugePagesName(HugePages hugePages) {
+	return hugePages == HUGE_PAGES_THP ? "thp" : hugePages == HUGE_PAGES_EXPLICIT ? "explicit" : "none";
+}
+
+// Reads a sysfs list such as "0-3,8-11"
+// Returns false if path can't be read
+static bool readList(const std::string & path, std::vector<int> & items) {
+	std::ifstream in(path.c_str());
+	std::string list;
+	if (!std::getline(in, list)) {
+		return false;
+	}
+	items.clear();
+	const char * p = list.c_str();
+	while (*p) {
+		char * end;
+		long first = strtol(p, &end, 10);
+		if (end == p) break;
+		long last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (long i = first; i <= last; i++) {
+			items.push_back(i);
+		}
+		if (*p == ',') p++;
+	}
+	return true;
+}
+
+
+// REGIONS
+
+void * mapRegion(size_t bytes, HugePages hugePages, int node, size_t & mapped) {
+	mapped = bytes ? bytes : 1;
+	if (hugePages != HUGE_PAGES_NONE) {
+		mapped = (mapped + HUGE_PAGE_BYTES - 1) & ~(size_t) (HUGE_PAGE_BYTES - 1);
+	}
+
+	// Step 1: Map it, from the hugetlb pool if asked
+	void * base = MAP_FAILED;
+	if (hugePages == HUGE_PAGES_EXPLICIT) {
+		base = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base == MAP_FAILED) {
+			std::cerr << "Explicit huge pages unavailable (see /proc/sys/vm/nr_hugepages), using transparent ones" << std::endl;
+			hugePages = HUGE_PAGES_THP;
+		}
+	}
+	if (base == MAP_FAILED && hugePages == HUGE_PAGES_THP) {
+		// One extra huge page to align the start on
+		size_t padded = mapped + HUGE_PAGE_BYTES;
+		char * raw = (char *) mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED) {
+			perror("mmap:");
+			return NULL;
+		}
+		char * aligned = (char *) (((uintptr_t) raw + HUGE_PAGE_BYTES - 1) & ~(uintptr_t) (HUGE_PAGE_BYTES - 1));
+		if (aligned > raw) munmap(raw, aligned - raw);
+		if (raw + padded > aligned + mapped) munmap(aligned + mapped, raw + padded - (aligned + mapped));
+		base = aligned;
+		if (madvise(base, mapped, MADV_HUGEPAGE) < 0) {
+			perror("madvise(MADV_HUGEPAGE):");
+		}
+	}
+	if (base == MAP_FAILED) {
+		base = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) {
+			perror("mmap:");
+			return NULL;
+		}
+	}
+
+	// Step 2: Bind it to node before anything is written to it
+	if (node >= 0) {
+		std::vector<unsigned long> mask(node / (8 * sizeof(unsigned long)) + 1, 0);
+		mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_mbind, base, mapped, MPOL_BIND, mask.data(), mask.size() * 8 * sizeof(unsigned long) + 1, 0) < 0) {
+			perror("mbind:");
+		}
+	}
+	return base;
+}
+
+void unmapRegion(void * base, size_t mapped) {
+	if (base != NULL) {
+		munmap(base, mapped);
+	}
+}
+
+
+// NODES AND THREADS
+
+int numaNodeCount() {
+	std::vector<int> nodes;
+	if (!readList("/sys/devices/system/node/online", nodes) || nodes.empty()) {
+		return 1;
+	}
+	return nodes.back() + 1;
+}
+
+int currentNumaNode() {
+	unsigned int cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0) {
+		return 0;
+	}
+	return node;
+}
+
+int bindThreadToNode(int node) {
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	std::vector<int> cpus;
+	if (!readList(path, cpus) || cpus.empty()) {
+		return -1;
+	}
+
+	cpu_set_t current, local, both;
+	CPU_ZERO(&local);
+	for (size_t i = 0; i < cpus.size(); i++) {
+		if (cpus[i] < CPU_SETSIZE) CPU_SET(cpus[i], &local);
+	}
+	if (sched_getaffinity(0, sizeof(current), &current) == 0) {
+		CPU_AND(&both, &current, &local);
+		if (CPU_COUNT(&both) > 0) {
+			local = both;
+		}
+	}
+	if (sched_setaffinity(0, sizeof(local), &local) < 0) {
+		perror("sched_setaffinity:");
+		return -1;
+	}
+	return 0;
+}
+
+static bool bindingThreads = false;
+static __thread int boundNode = -1;
+
+void bindServingThreads() {
+	bindingThreads = true;
+}
+
+void bindToLocalNode() {
+	if (!bindingThreads || boundNode >= 0) {
+		return;
+	}
+	int node = currentNumaNode();
+	if (bindThreadToNode(node) == 0) {
+		boundNode = node;
+	}
+}
+
+int boundNumaNode() {
+	return boundNode;
+}
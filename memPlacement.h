@@ -0,0 +1,60 @@
+#ifndef MEM_PLACEMENT_H
+#define MEM_PLACEMENT_H
+
+#include <stddef.h>
+#include <string>
+
+// MEMORY PLACEMENT
+// Where large read-only structures live: on which page size, and on which
+// NUMA node. Uses the raw system calls (mmap, madvise, mbind, getcpu) and
+// /sys/devices/system/node, so nothing links libnuma; without NUMA there
+// is a single node 0
+//
+// Huge pages cut the TLB misses of random lookups over a big table:
+//   HUGE_PAGES_THP       transparent huge pages (madvise(MADV_HUGEPAGE) on
+//                        a 2 MB aligned mapping; the kernel may still use
+//                        4 KB pages, see AnonHugePages in /proc/meminfo)
+//   HUGE_PAGES_EXPLICIT  MAP_HUGETLB, from the pool reserved in
+//                        /proc/sys/vm/nr_hugepages; falls back to THP (with a
+//                        warning) when the pool is too small
+
+enum HugePages {
+	HUGE_PAGES_NONE,
+	HUGE_PAGES_THP,
+	HUGE_PAGES_EXPLICIT
+};
+
+// Parses "none", "thp" or "explicit"
+// Returns false if str is none of them
+bool parseHugePages(const std::string & str, HugePages & hugePages);
+const char * hugePagesName(HugePages hugePages);
+
+// Maps at least bytes of zeroed memory, on huge pages as asked and, if node
+// is not -1, bound to node (pages are placed when first written, wherever
+// the writing thread runs)
+// Returns NULL on error; otherwise sets mapped to the size to unmap
+void * mapRegion(size_t bytes, HugePages hugePages, int node, size_t & mapped);
+void unmapRegion(void * base, size_t mapped);
+
+// The number of NUMA nodes (1 without NUMA)
+int numaNodeCount();
+
+// The node of the CPU the calling thread runs on
+int currentNumaNode();
+
+// Keeps the calling thread on node's CPUs; a thread already pinned to some
+// of them (such as a reactor) stays on those
+// Returns 0 on success and -1 on error
+int bindThreadToNode(int node);
+
+// A roster with a copy per node (see flatRoster.h) calls bindServingThreads()
+// while loading; from then on, bindToLocalNode() binds the calling thread to
+// the node it runs on. Serving threads call it once, as they start, so that
+// they keep reading the same node's copy (otherwise it does nothing)
+void bindServingThreads();
+void bindToLocalNode();
+
+// The node bindToLocalNode() bound the calling thread to, or -1
+int boundNumaNode();
+
+#endif
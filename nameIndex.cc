@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <string.h>
+#include "common.h"
+#include "nameIndex.h"
+
+// RECORD COMPARISONS
+// Records are "<name>\0<group>\0<student>\0"; names compare ignoring case
+
+static inline unsigned char fold(unsigned char c) {
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// Orders records by (name, group, student)
+static int compareRecords(const char * a, const char * b) {
+	for (int fields = 0; fields < 3; a++, b++) {
+		unsigned char x = fold(*a), y = fold(*b);
+		if (x != y) {
+			return x < y ? -1 : 1;
+		}
+		if (!x) {
+			fields++;
+		}
+	}
+	return 0;
+}
+
+// 0 if name starts with prefix (lowercased), otherwise the order of the two
+static int comparePrefix(const char * name, const std::string & prefix) {
+	for (size_t i = 0; i < prefix.length(); i++) {
+		unsigned char x = fold(name[i]), y = prefix[i];
+		if (x != y) {
+			return x < y ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+static const char * groupOf(const char * record) {
+	return record + strlen(record) + 1;
+}
+
+// The first 8 bytes of the lowercased name: keys order like the names
+static uint64_t nameKey(const char * name) {
+	uint64_t key = 0;
+	for (int i = 0; i < 8; i++) {
+		unsigned char c = *name ? fold(*name++) : 0;
+		key = key << 8 | c;
+	}
+	return key;
+}
+
+// NAME INDEX
+
+NameIndex::NameIndex() {
+	pthread_mutex_init(&m, NULL);
+}
+
+NameIndex::~NameIndex() {
+	pthread_mutex_destroy(&m);
+}
+
+void NameIndex::add(const std::string & groupId, const std::string & studentId, const std::string & name) {
+	Entry entry = {nameKey(name.c_str()), arena.length()};
+	arena.append(name.c_str(), name.length() + 1);
+	arena.append(groupId.c_str(), groupId.length() + 1);
+	arena.append(studentId.c_str(), studentId.length() + 1);
+	byName.push_back(entry);
+}
+
+void NameIndex::finish() {
+	arena.shrink_to_fit();
+	byName.shrink_to_fit();
+
+	struct NameOrder {
+		const char * arena;
+		bool operator()(const Entry & a, const Entry & b) const {
+			return a.key != b.key ? a.key < b.key : compareRecords(arena + a.offset, arena + b.offset) < 0;
+		}
+	};
+	NameOrder nameOrder = {arena.data()};
+	std::sort(byName.begin(), byName.end(), nameOrder);
+
+	// Stable, so that the students of a group stay in name order
+	struct GroupOrder {
+		const NameIndex * index;
+		bool operator()(uint32_t a, uint32_t b) const {
+			return strcmp(groupOf(index->record(a)), groupOf(index->record(b))) < 0;
+		}
+	};
+	byGroup.resize(byName.size());
+	for (size_t i = 0; i < byGroup.size(); i++) {
+		byGroup[i] = i;
+	}
+	GroupOrder groupOrder = {this};
+	std::stable_sort(byGroup.begin(), byGroup.end(), groupOrder);
+}
+
+// "<lowercased name>\0<group>\0<student>", the key of added
+static std::string addedKey(const std::string & groupId, const std::string & studentId, const std::string & name) {
+	std::string key = name;
+	tolower(key);
+	key += '\0';
+	key += groupId;
+	key += '\0';
+	key += studentId;
+	return key;
+}
+
+void NameIndex::insert(const std::string & groupId, const std::string & studentId, const std::string & name) {
+	std::string key = addedKey(groupId, studentId, name);
+	pthread_mutex_lock(&m);
+	added.insert(key);
+	pthread_mutex_unlock(&m);
+}
+
+void NameIndex::remove(const std::string & groupId, const std::string & studentId, const std::string & name) {
+	std::string key = addedKey(groupId, studentId, name);
+	pthread_mutex_lock(&m);
+	added.erase(key);
+	pthread_mutex_unlock(&m);
+}
+
+void NameIndex::search(const std::string & groupId, const std::string & prefix, const RosterRecord * after, NameVisitor visit, void * arg) const {
+	bool scoped = !groupId.empty();
+	// Where to start: the first record with the prefix, or the first
+	// record after the cursor
+	std::string start = after != NULL ? addedKey(after->groupId, after->studentId, after->studentName) : "";
+	uint64_t key = nameKey(after != NULL ? start.c_str() : prefix.c_str());
+
+	// The first indexed record that may match
+	size_t lo = 0, hi = byName.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		bool less;
+		if (scoped) {
+			const char * r = record(byGroup[mid]);
+			int c = strcmp(groupOf(r), groupId.c_str());
+			less = c ? c < 0 : after != NULL ? compareRecords(r, start.c_str()) <= 0 : comparePrefix(r, prefix) < 0;
+		} else if (byName[mid].key != key) {
+			less = byName[mid].key < key;
+		} else {
+			less = after != NULL ? compareRecords(record(mid), start.c_str()) <= 0 : comparePrefix(record(mid), prefix) < 0;
+		}
+		if (less) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	// The added records that match (few), copied so that the visitor,
+	// which may look them up in the roster, runs without the lock
+	std::vector<std::string> put;
+	pthread_mutex_lock(&m);
+	std::set<std::string>::const_iterator a = after != NULL ? added.upper_bound(start) : added.lower_bound(prefix);
+	for (; a != added.end() && comparePrefix(a->c_str(), prefix) == 0; ++a) {
+		if (!scoped || groupId == groupOf(a->c_str())) {
+			put.push_back(*a);
+		}
+	}
+	pthread_mutex_unlock(&m);
+
+	// Merge the indexed records with the added ones, in name order
+	size_t i = lo, j = 0;
+	while (1) {
+		const char * indexed = NULL;
+		if (i < byName.size()) {
+			const char * r = record(scoped ? byGroup[i] : i);
+			if (comparePrefix(r, prefix) == 0 && (!scoped || groupId == groupOf(r))) {
+				indexed = r;
+			}
+		}
+		const char * fresh = j < put.size() ? put[j].c_str() : NULL;
+		if (!indexed && !fresh) {
+			break;
+		}
+
+		// The same student indexed and added again is visited once
+		int c = !indexed ? 1 : !fresh ? -1 : compareRecords(indexed, fresh);
+		const char * next = c <= 0 ? indexed : fresh;
+		if (c <= 0) i++;
+		if (c >= 0) j++;
+
+		const char * group = groupOf(next);
+		const char * student = groupOf(group);
+		if (!visit(arg, group, student, next, c <= 0)) {
+			break;
+		}
+	}
+}
+
+size_t NameIndex::memoryBytes() const {
+	return arena.capacity() + byName.capacity() * sizeof(Entry) + byGroup.capacity() * sizeof(uint32_t);
+}
+
@@ -0,0 +1,80 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <pthread.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "roster.h"
+
+// NAME INDEX
+// Serves FIND: the students whose name starts with a prefix, ignoring case
+//
+// Built once at startup from Roster::scan(). Every record is appended to
+// one arena as "<name>\0<group>\0<student>\0", and two sorted arrays of
+// arena offsets order the records by (lowercased name, group, student) and
+// by (group, lowercased name, student). A query binary searches the array
+// for its scope and walks forward while the prefix matches: O(log n) plus
+// the records it returns. Memory is the roster's text plus 20 bytes per
+// student; each entry of the name array carries the first 8 bytes of its
+// lowercased name, so the search compares integers until it gets close
+//
+// Names PUT since startup go to a sorted set beside the arrays, and leave
+// it when the student is deleted or renamed. When the roster is writable,
+// every candidate is checked against the roster before it is returned,
+// which drops students deleted or renamed since
+
+// Receives the candidates of NameIndex::search(); name is as indexed
+// (exact) or lowercased. Returns false to end the search
+typedef bool (*NameVisitor)(
+	void * arg,
+	const std::string & groupId,
+	const std::string & studentId,
+	const std::string & name,
+	bool exact
+);
+
+class NameIndex {
+	struct Entry {
+		uint64_t key;					// first 8 bytes of the lowercased name, big-endian
+		uint64_t offset;				// of the record in arena
+	};
+
+	std::string arena;
+	std::vector<Entry> byName;
+	std::vector<uint32_t> byGroup;		// positions in byName, by (group, name, student)
+
+	mutable pthread_mutex_t m;
+	std::set<std::string> added;		// "<lowercased name>\0<group>\0<student>"
+
+	const char * record(uint32_t position) const {
+		return arena.data() + byName[position].offset;
+	}
+
+public:
+	NameIndex();
+	~NameIndex();
+
+	// Building: add() every record, then finish()
+	void add(const std::string & groupId, const std::string & studentId, const std::string & name);
+	void finish();
+
+	// Indexes a name PUT while serving
+	void insert(const std::string & groupId, const std::string & studentId, const std::string & name);
+
+	// Forgets a name insert()ed, once the student is deleted or renamed
+	void remove(const std::string & groupId, const std::string & studentId, const std::string & name);
+
+	// Visits the candidates for prefix (lowercased) in name order, only in
+	// groupId unless it is empty, and only those ordered after after (its
+	// name lowercased) unless it is NULL; visit runs without the index locked
+	void search(const std::string & groupId, const std::string & prefix, const RosterRecord * after, NameVisitor visit, void * arg) const;
+
+	size_t size() const {
+		return byName.size();
+	}
+	size_t memoryBytes() const;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include <sstream>
+#include <stdlib.h>
+#include "common.h"
+#include "rateLimit.h"
+
+// Tokens are kept in thousandths, so that slow rates still refill smoothly
+#define TOKEN 1000
+
+// RATE LIMIT OPTIONS
+
+bool parseRateLimitOption(int argc, char * argv[], int & i, RateLimitOptions & options) {
+	std::string arg = argv[i];
+	if (arg == "--udp-allow-stop") {
+		options.allowStop = true;
+		return true;
+	}
+	if (i + 1 >= argc || !isNumeric(argv[i + 1])) {
+		return false;
+	}
+	unsigned long value = strtoul(argv[i + 1], NULL, 10);
+	if (arg == "--udp-rate") {
+		options.clientRate = value;
+	} else if (arg == "--udp-burst") {
+		options.clientBurst = value;
+	} else if (arg == "--udp-global-rate") {
+		options.globalRate = value;
+	} else if (arg == "--udp-clients" && value > 0) {
+		options.clients = value;
+	} else {
+		return false;
+	}
+	i++;
+	return true;
+}
+
+const char * RATE_LIMIT_USAGE = "[--udp-rate <n>] [--udp-burst <n>] [--udp-global-rate <n>] [--udp-clients <n>] [--udp-allow-stop]";
+
+
+// RATE LIMITER
+
+RateLimiter::RateLimiter(const RateLimitOptions & _options):
+	options(_options),
+	received(0),
+	droppedClient(0),
+	droppedGlobal(0)
+{
+	if (options.clientBurst == 0) {
+		options.clientBurst = options.clientRate / 10 ? options.clientRate / 10 : 1;
+	}
+	// A whole number of sets, a power of two of them
+	size_t sets = 1;
+	while (sets * RATE_LIMIT_WAYS < options.clients) {
+		sets *= 2;
+	}
+	Bucket empty = {0, 0, 0};
+	table.assign(options.clientRate ? sets * RATE_LIMIT_WAYS : 0, empty);
+	setMask = sets - 1;
+	global = empty;
+}
+
+unsigned int RateLimiter::take(Bucket & bucket, uint64_t now, unsigned long rate, unsigned long burst, unsigned int wanted) {
+	uint64_t full = (uint64_t) burst * TOKEN;
+	if (full > UINT32_MAX) {
+		full = UINT32_MAX;
+	}
+	if (bucket.stamp == 0) {
+		bucket.tokens = full;
+	} else if (now > bucket.stamp) {
+		// A bucket idle for a second or more is full anyway
+		uint64_t elapsed = now - bucket.stamp < 1000000 ? now - bucket.stamp : 1000000;
+		uint64_t tokens = bucket.tokens + elapsed * rate / 1000;
+		bucket.tokens = tokens < full ? tokens : full;
+	}
+	bucket.stamp = now;
+
+	unsigned int taken = bucket.tokens / TOKEN;
+	if (taken > wanted) {
+		taken = wanted;
+	}
+	bucket.tokens -= taken * TOKEN;
+	return taken;
+}
+
+RateLimiter::Bucket & RateLimiter::lookup(uint32_t addr) {
+	Bucket * set = &table[(((addr * 0x9e3779b1u) >> 7) & setMask) * RATE_LIMIT_WAYS];
+	Bucket * victim = &set[0];
+	for (int way = 0; way < RATE_LIMIT_WAYS; way++) {
+		if (set[way].stamp && set[way].addr == addr) {
+			return set[way];
+		}
+		if (set[way].stamp < victim->stamp) {
+			victim = &set[way];
+		}
+	}
+
+	// Not tracked: take over the way idle the longest (or a free one)
+	victim->addr = addr;
+	victim->stamp = 0;
+	return *victim;
+}
+
+unsigned int RateLimiter::admit(uint32_t addr, uint64_t now, unsigned int count) {
+	received += count;
+	unsigned int admitted = count;
+	Bucket * bucket = NULL;
+	if (options.clientRate) {
+		bucket = &lookup(addr);
+		admitted = take(*bucket, now, options.clientRate, options.clientBurst, count);
+		droppedClient += count - admitted;
+	}
+	if (options.globalRate && admitted) {
+		unsigned int taken = take(global, now, options.globalRate, options.globalRate / 10 ? options.globalRate / 10 : 1, admitted);
+		droppedGlobal += admitted - taken;
+		// The source keeps the tokens of what the global bucket refused
+		if (bucket != NULL) {
+			bucket->tokens += (admitted - taken) * TOKEN;
+		}
+		admitted = taken;
+	}
+	return admitted;
+}
+
+std::string RateLimiter::stats() const {
+	std::stringstream ss;
+	ss << "received " << received << " dropped_client " << droppedClient << " dropped_global " << droppedGlobal;
+	return ss.str();
+}
@@ -0,0 +1,84 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// RATE LIMITER
+// Admission control for the UDP server: every source IP address gets a
+// token bucket (refilled at --udp-rate datagrams per second, holding up to
+// --udp-burst), and all sources share a global bucket (--udp-global-rate).
+// A datagram that finds no token is dropped before it is parsed, without
+// a reply, so a flooding sender costs little more than the recvmsg()
+//
+// The buckets live in a fixed set-associative table (--udp-clients
+// entries, RATE_LIMIT_WAYS per set): a source that isn't in its set
+// replaces the way idle the longest, and starts with a full bucket. Memory
+// stays bounded however many sources there are; a churn of sources can
+// only make the limit more lenient, never drop a well-behaved client
+//
+// With limits set, STOP over UDP (and the empty datagram that also ends
+// serving) is ignored unless --udp-allow-stop is given, since any source
+// address could send it; when allowed it is admitted like any request
+
+#define RATE_LIMIT_WAYS 4
+
+struct RateLimitOptions {
+	unsigned long clientRate;			// datagrams per second per source, 0: unlimited
+	unsigned long clientBurst;			// bucket size per source (default: clientRate / 10)
+	unsigned long globalRate;			// datagrams per second in all, 0: unlimited
+	unsigned long clients;				// sources tracked at once (default 16384)
+	bool allowStop;						// STOP is obeyed even with limits set
+
+	RateLimitOptions(): clientRate(0), clientBurst(0), globalRate(0), clients(16384), allowStop(false) {}
+};
+
+// Consumes argv[i] (and its value) if it is a rate limiting option
+// Returns false if argv[i] is not a (well-formed) rate limiting option
+bool parseRateLimitOption(int argc, char * argv[], int & i, RateLimitOptions & options);
+
+// Usage string for the rate limiting options
+extern const char * RATE_LIMIT_USAGE;
+
+class RateLimiter {
+	struct Bucket {
+		uint32_t addr;					// source IPv4 address (network order)
+		uint32_t tokens;				// in thousandths of a datagram
+		uint64_t stamp;					// last refill (us), 0 if the way is free
+	};
+
+	RateLimitOptions options;
+	std::vector<Bucket> table;
+	size_t setMask;
+	Bucket global;
+
+	// Refills bucket up to now, then takes up to wanted tokens from it
+	// Returns the number of tokens taken
+	static unsigned int take(Bucket & bucket, uint64_t now, unsigned long rate, unsigned long burst, unsigned int wanted);
+	Bucket & lookup(uint32_t addr);
+
+public:
+	uint64_t received;					// datagrams
+	uint64_t droppedClient;				// over their source's quota
+	uint64_t droppedGlobal;				// over the global quota
+
+	RateLimiter(const RateLimitOptions & options);
+
+	bool enabled() const {
+		return options.clientRate || options.globalRate;
+	}
+	// Whether a (admitted) STOP ends serving
+	bool stopAllowed() const {
+		return !enabled() || options.allowStop;
+	}
+
+	// Admits up to count datagrams from addr at time now (us)
+	// Returns the number admitted; the rest are to be dropped
+	unsigned int admit(uint32_t addr, uint64_t now, unsigned int count);
+
+	// The counters, as "received <n> dropped_client <n> dropped_global <n>"
+	std::string stats() const;
+};
+
+#endif
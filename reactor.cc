@@ -0,0 +1,410 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "reactor.h"
+
+int mybind(int sockfd, struct sockaddr_in * addr);
+
+#define MAX_EVENTS 256
+
+// Timer wheel of a reactor: TIMER_SLOTS slots, ticks of an eighth of the
+// shortest timeout (within TIMER_TICK_MIN_MS - TIMER_TICK_MAX_MS)
+#define TIMER_SLOTS 1024
+#define TIMER_TICK_MIN_MS 10
+#define TIMER_TICK_MAX_MS 1000
+
+static uint64_t timerTick(const ConnectionOptions & options) {
+	uint64_t shortest = options.idleTimeoutMs;
+	if (options.readTimeoutMs && (!shortest || options.readTimeoutMs < shortest)) {
+		shortest = options.readTimeoutMs;
+	}
+	if (options.writeLimit() && (!shortest || options.writeLimit() < shortest)) {
+		shortest = options.writeLimit();
+	}
+	uint64_t tick = shortest / 8;
+	return tick < TIMER_TICK_MIN_MS ? TIMER_TICK_MIN_MS : tick > TIMER_TICK_MAX_MS ? TIMER_TICK_MAX_MS : tick;
+}
+
+// REACTOR
+
+Reactor::Reactor(int cpu, int listenSoc, Roster * roster, EndSession * endSession, const ConnectionOptions & options):
+	cpu(cpu),
+	listenSoc(listenSoc),
+	epfd(-1),
+	roster(roster),
+	endSession(endSession),
+	draining(false),
+	options(options),
+	timers(TIMER_SLOTS, timerTick(options), monotonicMillis()),
+	timerFd(-1),
+	expired(0)
+{}
+
+int Reactor::spawn() {
+	// Pin the reactor to its CPU from its first instruction, so that
+	// everything it allocates is local to that CPU
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	int err = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	if (err == 0) {
+		err = pthread_create(&id, &attr, start, this);
+	}
+	pthread_attr_destroy(&attr);
+	if (err == 0) {
+		return 0;
+	}
+
+	// The CPU is not ours to use (EINVAL): serve unpinned rather than not at all
+	std::cerr << "Reactor: could not pin to CPU " << cpu << ": " << strerror(err) << ", running unpinned" << std::endl;
+	err = pthread_create(&id, NULL, start, this);
+	if (err != 0) {
+		std::cerr << "Reactor: " << strerror(err) << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+void Reactor::join() {
+	pthread_join(id, NULL);
+}
+
+void * Reactor::start(void * arg) {
+	((Reactor *) arg)->run();
+	return NULL;
+}
+
+void Reactor::run() {
+	bindToLocalNode();
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1:");
+		endSession->set();
+		return;
+	}
+
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;					// NULL identifies the listening socket
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listenSoc, &ev);
+	if (options.timeouts() && startTimers() < 0) {
+		endSession->set();
+		close(epfd);
+		return;
+	}
+
+	epoll_event events[MAX_EVENTS];
+	while (!endSession->isSet()) {
+		if (draining.load(std::memory_order_acquire)) {
+			// The listener now belongs to the server that took over
+			if (listenSoc >= 0) {
+				epoll_ctl(epfd, EPOLL_CTL_DEL, listenSoc, NULL);
+				close(listenSoc);
+				listenSoc = -1;
+			}
+			if (connections.empty()) {
+				break;
+			}
+		}
+
+		// The timeout lets the reactor notice a STOP sent to another reactor
+		int n = epoll_wait(epfd, events, MAX_EVENTS, SELECT_WAIT_SECS * 1000 + SELECT_WAIT_MICROSECS / 1000);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("epoll_wait:");
+			endSession->set();
+			break;
+		}
+
+		trace.woke();
+		bool tick = false;
+		for (int i = 0; i < n; i++) {
+			Connection * conn = (Connection *) events[i].data.ptr;
+			if (conn == NULL) {
+				if (listenSoc >= 0) acceptClients();
+				continue;
+			}
+			if (events[i].data.ptr == &timers) {
+				tick = true;
+				continue;
+			}
+
+			bool open = true;
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+				open = readClient(conn);
+			}
+			if (open && (events[i].events & EPOLLOUT)) {
+				open = writeClient(conn);
+			}
+			if (!open) {
+				closeClient(conn);
+			}
+		}
+
+		// Only once this batch is done: its events may point to connections
+		// that are about to expire
+		if (tick) {
+			uint64_t expirations;
+			if (read(timerFd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+				perror("timerfd:");
+			}
+			timers.advance(monotonicMillis(), expire, this);
+		}
+	}
+
+	// Cleanup, close all connections owned by this reactor
+	while (!connections.empty()) {
+		closeClient(connections.begin()->second);
+	}
+	close(epfd);
+	if (timerFd >= 0) {
+		close(timerFd);
+	}
+	if (listenSoc >= 0) {
+		close(listenSoc);
+	}
+}
+
+int Reactor::startTimers() {
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerFd < 0) {
+		perror("timerfd_create:");
+		return -1;
+	}
+
+	// One wakeup per tick, whatever the number of connections
+	itimerspec spec;
+	spec.it_interval.tv_sec = timers.tick() / 1000;
+	spec.it_interval.tv_nsec = (timers.tick() % 1000) * 1000000;
+	spec.it_value = spec.it_interval;
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &timers;
+	if (timerfd_settime(timerFd, 0, &spec, NULL) < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &ev) < 0) {
+		perror("timerfd:");
+		close(timerFd);
+		timerFd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void Reactor::rearm(Connection * conn, uint64_t now) {
+	if (timerFd < 0) {
+		return;
+	}
+	conn->partialSince = conn->in.empty() ? 0 : conn->partialSince ? conn->partialSince : now;
+	uint64_t deadline = options.deadline(now, conn->partialSince, conn->blockedSince);
+	if (deadline) {
+		timers.touch(conn, deadline);
+	} else {
+		timers.cancel(conn);
+	}
+}
+
+void Reactor::expire(void * arg, TimerNode * node) {
+	Reactor * reactor = (Reactor *) arg;
+	reactor->expired++;
+	reactor->closeClient(static_cast<Connection *>(node));
+}
+
+void Reactor::acceptClients() {
+	while (1) {
+		int clientSoc = accept4(listenSoc, NULL, NULL, SOCK_NONBLOCK);
+		if (clientSoc < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				perror("Accept:");
+			}
+			return;
+		}
+
+		Connection * conn = new Connection(clientSoc);
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, clientSoc, &ev) < 0) {
+			perror("epoll_ctl:");
+			close(clientSoc);
+			delete conn;
+			continue;
+		}
+		connections[clientSoc] = conn;
+		rearm(conn, monotonicMillis());
+	}
+}
+
+bool Reactor::readClient(Connection * conn) {
+	char buf[4096];
+	uint64_t arrival = 0;
+	while (1) {
+		uint64_t stamp = 0;
+		int l = trace.enabled()
+			? traceRead(conn->sockfd, buf, sizeof(buf), &stamp)
+			: read(conn->sockfd, buf, sizeof(buf));
+		if (l < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return false;
+		}
+		if (l == 0) {
+			// Client closed the connection
+			return false;
+		}
+		if (!conn->closing) {
+			conn->in.append(buf, l);
+		}
+		if (!arrival) {
+			arrival = stamp;
+		}
+		// The rest waits for the next event, once these are parsed
+		if (l < (int) sizeof(buf) || conn->in.length() > MAX_REQUEST_BYTES) break;
+	}
+	trace.received(arrival);
+
+	// Commands are terminated by a newline or by the NUL the clients send
+	size_t start = 0;
+	while (!conn->closing) {
+		size_t end = conn->in.find_first_of(std::string("\n\0", 2), start);
+		if (end == std::string::npos) break;
+
+		trace.start();
+		InputBuffer inputBuffer(conn->in.substr(start, end - start));
+		start = end + 1;
+		if (!inputBuffer.next()) continue;
+		trace.parsed(inputBuffer);
+
+		// STOP case (stop() == true implies stopSession() == true)
+		if (inputBuffer.stop()) {
+			// Communicate to the other reactors that STOP has been sent
+			endSession->set();
+		}
+		if (inputBuffer.stopSession()) {
+			conn->closing = true;
+			break;
+		}
+
+		// GET and error cases; every reply ends with a NUL
+		std::string reply;
+		if (execute(inputBuffer, roster, reply)) {
+			conn->out += reply;
+			conn->out += '\0';
+		}
+		trace.executed();
+	}
+	conn->in.erase(0, start);
+	if (conn->in.length() > MAX_REQUEST_BYTES) {
+		conn->out += std::string(REQUEST_TOO_LONG, sizeof(REQUEST_TOO_LONG));
+		conn->in.clear();
+		conn->closing = true;
+	}
+
+	bool open = writeClient(conn);
+	trace.written();
+	return open;
+}
+
+bool Reactor::writeClient(Connection * conn) {
+	bool progress = false;
+	while (!conn->out.empty()) {
+		int l = write(conn->sockfd, conn->out.data(), conn->out.length());
+		if (l < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return false;
+		}
+		conn->out.erase(0, l);
+		progress = true;
+	}
+
+	// Replies the client doesn't take count against the write timeout
+	uint64_t now = monotonicMillis();
+	conn->blockedSince = conn->out.empty() ? 0 : progress || !conn->blockedSince ? now : conn->blockedSince;
+	rearm(conn, now);
+
+	// Only wait for writability while replies are pending, and stop reading
+	// requests while a client leaves more than MAX_REQUEST_BYTES of them
+	epoll_event ev;
+	ev.events = (conn->out.length() > MAX_REQUEST_BYTES ? 0 : EPOLLIN) | (conn->out.empty() ? 0 : EPOLLOUT);
+	ev.data.ptr = conn;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, conn->sockfd, &ev);
+
+	return !(conn->closing && conn->out.empty());
+}
+
+void Reactor::closeClient(Connection * conn) {
+	timers.cancel(conn);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->sockfd, NULL);
+	close(conn->sockfd);
+	connections.erase(conn->sockfd);
+	delete conn;
+}
+
+
+// SOCKET UTILITIES
+
+int reservePort(sockaddr_in * addr) {
+	int soc = socket(AF_INET, SOCK_STREAM, 0);
+	if (soc < 0) {
+		perror("Socket:");
+		return -1;
+	}
+	if (mybind(soc, addr) < 0) {
+		close(soc);
+		return -1;
+	}
+
+	// Set only once bound: the listeners may now share the port, but
+	// another server's probe (without SO_REUSEPORT) still can't take it
+	int one = 1;
+	if (setsockopt(soc, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+		perror("SO_REUSEPORT:");
+		close(soc);
+		return -1;
+	}
+	return soc;
+}
+
+int reusePortListener(const sockaddr_in * addr) {
+	int soc = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (soc < 0) {
+		perror("Socket:");
+		return -1;
+	}
+
+	int one = 1;
+	if (setsockopt(soc, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+		perror("SO_REUSEPORT:");
+		close(soc);
+		return -1;
+	}
+
+	if (bind(soc, (const sockaddr *) addr, sizeof(sockaddr_in)) < 0 || listen(soc, 1000) < 0) {
+		perror("Bind/Listen:");
+		close(soc);
+		return -1;
+	}
+	return soc;
+}
+
+std::vector<int> availableCpus() {
+	std::vector<int> cpus;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int c = 0; c < CPU_SETSIZE; c++) {
+			if (CPU_ISSET(c, &set)) cpus.push_back(c);
+		}
+	}
+	if (cpus.empty()) {
+		cpus.push_back(0);
+	}
+	return cpus;
+}
@@ -0,0 +1,93 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <atomic>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "tcpHandler.h"
+#include "timerWheel.h"
+#include "trace.h"
+
+// REACTOR
+// An event loop serving TCP clients on one CPU: each reactor owns its
+// own SO_REUSEPORT listening socket, epoll set and connections, and runs
+// on a thread pinned to its CPU. The kernel spreads incoming connections
+// across the listening sockets, so reactors share nothing but the
+// roster and the STOP flag
+
+// With timeouts set, every connection is on the reactor's timer wheel
+// (see timerWheel.h), which one timerfd in the epoll set drives
+
+struct Connection : TimerNode {
+	int sockfd;
+	std::string in;						// bytes received but not yet parsed
+	std::string out;					// replies not yet accepted by the socket
+	bool closing;						// STOP_SESSION received, close once out is sent
+	uint64_t partialSince;				// when in started holding a partial request, or 0
+	uint64_t blockedSince;				// since when out has been waiting on the client, or 0
+
+	Connection(int sockfd): sockfd(sockfd), closing(false), partialSince(0), blockedSince(0) {}
+};
+
+class Reactor {
+	int cpu;
+	int listenSoc;
+	int epfd;
+	Roster * roster;
+	EndSession * endSession;
+	pthread_t id;
+	std::atomic<bool> draining;			// handed off: stop accepting, exit when idle
+	std::unordered_map<int, Connection *> connections;
+	TraceBatch trace;
+	ConnectionOptions options;
+	TimerWheel timers;
+	int timerFd;
+
+	void acceptClients();
+	// Returns false once the connection should be closed
+	bool readClient(Connection * conn);
+	bool writeClient(Connection * conn);
+	void closeClient(Connection * conn);
+	// Reschedules conn's timeout after activity at now
+	void rearm(Connection * conn, uint64_t now);
+	static void expire(void * arg, TimerNode * node);
+	int startTimers();
+	void run();
+	static void * start(void * arg);
+
+public:
+	uint64_t expired;					// connections closed by a timeout
+
+	Reactor(int cpu, int listenSoc, Roster * roster, EndSession * endSession, const ConnectionOptions & options);
+
+	// Start the reactor on its own pinned thread
+	// Returns 0 on success and -1 on error
+	int spawn();
+	void join();
+
+	// Stop accepting new connections, and exit once the current ones end
+	void drain() {
+		draining.store(true, std::memory_order_release);
+	}
+};
+
+// Picks a port for addr with mybind() (see mybind.c) on a socket bound
+// without SO_REUSEPORT, so that a port some other server listens on (with
+// SO_REUSEPORT or not) is skipped; the socket then holds the port for
+// reusePortListener() until it is closed
+// Returns the socket, or -1 on error
+int reservePort(sockaddr_in * addr);
+
+// Creates a listening socket with SO_REUSEPORT set and binds it to addr
+// (a port held by reservePort(), or taken over from a previous server)
+// Returns the socket, or -1 on error
+int reusePortListener(const sockaddr_in * addr);
+
+// The CPUs this process may run on, one reactor is started per CPU
+std::vector<int> availableCpus();
+
+#endif
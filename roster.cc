@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <time.h>
+#include "concurrentRoster.h"
+#include "diskRoster.h"
+#include "flatRoster.h"
+#include "indexedRoster.h"
+#include "roster.h"
+#include "wal.h"
+
+// ROSTER OPTIONS
+
+static bool parseIndexMode(const std::string & str, IndexMode & mode) {
+	if (str == "on") {
+		mode = INDEX_ON;
+	} else if (str == "off") {
+		mode = INDEX_OFF;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+const char * ROSTER_USAGE = "[--disk <file>] [--cache-mb <n>] [--wal <dir>] [--sync-us <n>] [--checkpoint-mb <n>] [--find-limit <n>] [--name-index <on|off>] [--student-index <on|off>] [--huge-pages <thp|explicit>] [--numa-replicate]";
+
+bool parseRosterOption(int argc, char * argv[], int & i, RosterOptions & options) {
+	std::string arg = argv[i];
+	if (arg == "--numa-replicate") {
+		options.numaReplicate = true;
+		return true;
+	}
+	if (i + 1 >= argc) {
+		return false;
+	}
+	if (arg == "--disk") {
+		options.diskPath = argv[++i];
+		return true;
+	}
+	if (arg == "--cache-mb" && isNumeric(argv[i + 1])) {
+		options.cacheBytes = strtoull(argv[++i], NULL, 10) << 20;
+		return true;
+	}
+	if (arg == "--wal") {
+		options.walDir = argv[++i];
+		return true;
+	}
+	if (arg == "--sync-us" && isNumeric(argv[i + 1])) {
+		options.syncDelayMicros = strtol(argv[++i], NULL, 10);
+		return true;
+	}
+	if (arg == "--checkpoint-mb" && isNumeric(argv[i + 1])) {
+		options.checkpointBytes = strtoull(argv[++i], NULL, 10) << 20;
+		return true;
+	}
+	if (arg == "--find-limit" && isNumeric(argv[i + 1])) {
+		options.findLimit = strtoull(argv[++i], NULL, 10);
+		return true;
+	}
+	if (arg == "--name-index" && parseIndexMode(argv[i + 1], options.nameIndex)) {
+		i++;
+		return true;
+	}
+	if (arg == "--student-index" && parseIndexMode(argv[i + 1], options.studentIndex)) {
+		i++;
+		return true;
+	}
+	if (arg == "--huge-pages" && parseHugePages(argv[i + 1], options.hugePages) && options.hugePages != HUGE_PAGES_NONE) {
+		i++;
+		return true;
+	}
+	return false;
+}
+
+// The read-only flat engine: one copy, or one per NUMA node
+static Roster * loadFlat(std::istream & in, const RosterOptions & options) {
+	timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	Roster * roster;
+	const FlatRoster * flat;
+	size_t copies = 1;
+	if (options.numaReplicate) {
+		ReplicatedRoster * replicated = new ReplicatedRoster();
+		roster = replicated;
+		if (replicated->build(in, options.hugePages) < 0) {
+			delete replicated;
+			return NULL;
+		}
+		flat = replicated->replica(0);
+		copies = replicated->copies();
+	} else {
+		FlatRoster * single = new FlatRoster();
+		roster = single;
+		if (single->build(in, options.hugePages, -1) < 0) {
+			delete single;
+			return NULL;
+		}
+		flat = single;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+	std::cerr << "Flat roster: " << flat->size() << " students, " << flat->bytes() / 1024 << " KB x "
+		<< copies << (copies > 1 ? " NUMA nodes" : " copy") << ", huge pages " << hugePagesName(options.hugePages)
+		<< ", built in " << ms << " ms" << std::endl;
+	return roster;
+}
+
+static Roster * loadEngine(std::istream & in, const RosterOptions & options) {
+	if (options.hugePages != HUGE_PAGES_NONE || options.numaReplicate) {
+		if (!options.diskPath.empty() || !options.walDir.empty()) {
+			std::cerr << "--huge-pages and --numa-replicate serve a read-only in-memory roster (no --disk or --wal)" << std::endl;
+			return NULL;
+		}
+		return loadFlat(in, options);
+	}
+	if (options.diskPath.empty()) {
+		ConcurrentRoster * roster = new ConcurrentRoster();
+		roster->load(in);
+		if (options.walDir.empty()) {
+			return roster;
+		}
+
+		// Logged changes go on top of the stdin roster
+		DurableRoster * durable = new DurableRoster(roster, options.walDir, options.syncDelayMicros, options.checkpointBytes);
+		if (durable->open() < 0) {
+			delete durable;
+			return NULL;
+		}
+		return durable;
+	}
+	if (!options.walDir.empty()) {
+		std::cerr << "--wal needs the in-memory roster (the on-disk roster is read-only)" << std::endl;
+		return NULL;
+	}
+
+	// The on-disk engine (read-only): sort stdin into the roster file, then open it
+	if (DiskRoster::build(in, options.diskPath, options.cacheBytes) < 0) {
+		return NULL;
+	}
+	DiskRoster * roster = new DiskRoster(options.cacheBytes);
+	if (roster->open(options.diskPath) < 0) {
+		delete roster;
+		return NULL;
+	}
+	return roster;
+}
+
+Roster * loadRoster(std::istream & in, const RosterOptions & options) {
+	Roster * roster = loadEngine(in, options);
+	if (roster == NULL) {
+		return NULL;
+	}
+	// The indexes cover the roster as loaded (and replayed from the WAL);
+	// engines that keep the roster out of the heap don't get the name
+	// index unless asked, since it holds a copy of every name, and the
+	// on-disk one doesn't get the student index either
+	bool inHeap = options.diskPath.empty() && options.hugePages == HUGE_PAGES_NONE && !options.numaReplicate;
+	bool nameIndex = options.nameIndex == INDEX_AUTO ? inHeap : options.nameIndex == INDEX_ON;
+	bool studentIndex = options.studentIndex == INDEX_AUTO ? options.diskPath.empty() : options.studentIndex == INDEX_ON;
+	size_t findLimit = nameIndex ? options.findLimit : 0;
+	if (!findLimit && !studentIndex) {
+		return roster;
+	}
+	return new IndexedRoster(roster, findLimit, studentIndex);
+}
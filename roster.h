@@ -0,0 +1,145 @@
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "memPlacement.h"
+
+// ROSTER
+// The storage engine behind the request engine. The server picks one at
+// startup (see loadRoster()); the code serving requests only sees Roster.
+// Engines that can be updated while serving (PUT/DEL) say so with writable()
+
+struct RosterRecord {
+	std::string groupId, studentId, studentName;
+};
+
+// Receives the records of Roster::scan()
+typedef void (*RosterVisitor)(void * arg, const std::string & groupId, const std::string & studentId, const std::string & studentName);
+
+class Roster {
+public:
+	virtual ~Roster() {}
+
+	// Looks up [groupId][studentId]
+	// Returns true and sets studentName if it exists; otherwise returns false
+	virtual bool find(
+		const std::string & groupId,
+		const std::string & studentId,
+		std::string & studentName
+	) const = 0;
+
+	// Whether put() and del() are supported; they may be called from
+	// several threads at once, concurrently with find()
+	virtual bool writable() const {
+		return false;
+	}
+
+	// Adds or replaces [groupId][studentId]
+	// Returns false if the engine is read-only or the change failed
+	virtual bool put(
+		const std::string & groupId,
+		const std::string & studentId,
+		const std::string & studentName
+	) {
+		return false;
+	}
+
+	// Removes [groupId][studentId]
+	// Returns 1 if it was removed, 0 if it did not exist and -1 on error
+	virtual int del(const std::string & groupId, const std::string & studentId) {
+		return -1;
+	}
+
+	// Calls visit for every record, in no particular order
+	// (used to build secondary indexes at startup, before serving)
+	virtual void scan(RosterVisitor visit, void * arg) const = 0;
+
+	// Finds the students whose name starts with prefix, ignoring case, in
+	// name order; only in groupId unless it is empty (see nameIndex.h), and
+	// only those after the record after (the last one returned by the
+	// previous call) unless it is NULL
+	// Returns -1 if the engine has no name index and -2 if after's name no
+	// longer starts with prefix; otherwise fills records (up to the engine's
+	// limit) and returns 1 if there were more, 0 if not
+	virtual int findByName(
+		const std::string & groupId,
+		const std::string & prefix,
+		const RosterRecord * after,
+		std::vector<RosterRecord> & records
+	) const {
+		return -1;
+	}
+
+	// Finds the groups studentId is in (see studentIndex.h)
+	// Returns -1 if the engine has no student index, otherwise fills records
+	// in group order (as many as fit in one reply) and returns 1 if there
+	// were more, 0 if not
+	virtual int whereStudent(const std::string & studentId, std::vector<RosterRecord> & records) const {
+		return -1;
+	}
+};
+
+
+// ROSTER OPTIONS
+// Command line options shared by the servers for picking the roster engine:
+//   --disk <file>     keep the roster in <file> (built from stdin) instead of
+//                     memory; the on-disk roster is read-only (no PUT/DEL)
+//   --cache-mb <n>    memory budget for the on-disk engine (default 64)
+//   --wal <dir>       log PUT/DEL to <dir> and replay it at startup (see wal.h)
+//   --sync-us <n>     longest a write waits for others to share its fdatasync()
+//                     (default 1000)
+//   --checkpoint-mb <n>  log size that triggers a checkpoint (default 64)
+//   --find-limit <n>  most records a FIND returns (default 100), the rest
+//                     fetched with "AFTER <group> <student>"; 0 skips
+//                     building the name index, and FIND is refused
+//   --name-index <on|off>  build the name index FIND needs (default: on for
+//                     the in-memory roster, off for --disk and the flat
+//                     roster, where it would hold every name in memory)
+//   --student-index <on|off>  build the student index WHERE needs (default:
+//                     off for --disk, on otherwise)
+//   --huge-pages <thp|explicit>  serve a read-only flat copy of the roster
+//                     (see flatRoster.h) on transparent or explicit huge
+//                     pages; only that copy is: the name and student indexes,
+//                     and the default writable roster, stay on normal pages
+//   --numa-replicate  serve a read-only flat copy of the roster per NUMA
+//                     node, each serving thread bound to the node it starts
+//                     on and reading that node's copy
+
+// Whether to build a secondary index
+enum IndexMode {
+	INDEX_AUTO,							// the engine's default
+	INDEX_ON,
+	INDEX_OFF
+};
+
+struct RosterOptions {
+	std::string diskPath;
+	size_t cacheBytes;
+	std::string walDir;
+	long syncDelayMicros;
+	size_t checkpointBytes;
+	size_t findLimit;
+	IndexMode nameIndex;
+	IndexMode studentIndex;
+	HugePages hugePages;
+	bool numaReplicate;
+
+	RosterOptions(): cacheBytes(64 << 20), syncDelayMicros(1000), checkpointBytes(64 << 20), findLimit(100),
+		nameIndex(INDEX_AUTO), studentIndex(INDEX_AUTO), hugePages(HUGE_PAGES_NONE), numaReplicate(false) {}
+};
+
+// Consumes argv[i] (and its value) if it is a roster option
+// Returns false if argv[i] is not a (well-formed) roster option
+bool parseRosterOption(int argc, char * argv[], int & i, RosterOptions & options);
+
+// Usage string for the roster options
+extern const char * ROSTER_USAGE;
+
+// Builds the roster selected by options from the records read from in
+// Returns NULL on error
+Roster * loadRoster(std::istream & in, const RosterOptions & options);
+
+#endif
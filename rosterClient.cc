@@ -0,0 +1,669 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "rosterClient.h"
+
+#define MAX_EVENTS 64
+#define READ_BUF_LEN 65536
+
+static uint64_t nowMillis() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// The group ID of a command: its first token, or its second after GET, PUT,
+// DEL or FIND (FIND without a group routes by its own name)
+static std::string routingKey(const std::string & command) {
+	std::stringstream ss(command);
+	std::string tok;
+	ss >> tok;
+	if (!strcasecmp(tok.c_str(), "GET") || !strcasecmp(tok.c_str(), "PUT") || !strcasecmp(tok.c_str(), "DEL")) {
+		ss >> tok;
+	} else if (!strcasecmp(tok.c_str(), "FIND")) {
+		std::string group;
+		if (ss >> group && isNumeric(group) && !(ss >> std::ws).eof()) {
+			tok = group;
+		}
+	}
+	return tok;
+}
+
+int resolveServer(const char * host, const char * port, sockaddr_in * addr) {
+	unsigned short portnum;
+	if (sscanf(port, "%hu", &portnum) < 1) {
+		std::cerr << "sscanf error" << std::endl;
+		return -1;
+	}
+
+	addrinfo hints;
+	memset(&hints, 0, sizeof(addrinfo));
+	hints.ai_family = AF_INET;
+
+	addrinfo * res;
+	if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+		std::cerr << "getaddrinfo error" << std::endl;
+		return -1;
+	}
+	memcpy(addr, res->ai_addr, sizeof(sockaddr_in));
+	freeaddrinfo(res);
+
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(portnum);
+	return 0;
+}
+
+
+// ROSTER CLIENT
+
+RosterClient::RosterClient(const std::vector<sockaddr_in> & servers, const ClientOptions & options):
+	servers(servers),
+	options(options),
+	ring(servers.size()),
+	cache(NULL),
+	epfd(-1),
+	wakeFd(-1),
+	started(false),
+	wakePending(false),
+	stopping(false),
+	pools(servers.size()),
+	udpFd(-1),
+	nextId(1),
+	udpOut(servers.size())
+{
+	pthread_mutex_init(&m, NULL);
+	if (options.cacheEntries > 0) {
+		cache = new ClientCache(options.cacheEntries, options.cacheTtlMillis, servers.size());
+	}
+}
+
+RosterClient::~RosterClient() {
+	if (started) {
+		pthread_mutex_lock(&m);
+		stopping = true;
+		pthread_mutex_unlock(&m);
+		uint64_t one = 1;
+		write(wakeFd, &one, sizeof(one));
+		pthread_join(ioThread, NULL);
+	}
+
+	// Fail whatever is left, now that the I/O thread is gone
+	pthread_mutex_lock(&m);
+	std::vector<Request *> left;
+	left.swap(queued);
+	stopping = true;
+	pthread_mutex_unlock(&m);
+	for (size_t i = 0; i < left.size(); i++) {
+		fail(left[i]);
+	}
+	for (size_t i = 0; i < udpBacklog.size(); i++) {
+		fail(udpBacklog[i]);
+	}
+	for (size_t s = 0; s < pools.size(); s++) {
+		for (size_t c = 0; c < pools[s].size(); c++) {
+			closeTcp(pools[s][c]);
+			delete pools[s][c];
+		}
+	}
+	std::unordered_map<uint64_t, Request *>::iterator it;
+	for (it = udpInFlight.begin(); it != udpInFlight.end(); ++it) {
+		fail(it->second);
+	}
+
+	if (udpFd >= 0) close(udpFd);
+	if (wakeFd >= 0) close(wakeFd);
+	if (epfd >= 0) close(epfd);
+	pthread_mutex_destroy(&m);
+	delete cache;
+}
+
+int RosterClient::connect() {
+	// Step 1: Create the epoll set, and the eventfd that wakes it up
+	epfd = epoll_create1(0);
+	wakeFd = eventfd(0, EFD_NONBLOCK);
+	if (epfd < 0 || wakeFd < 0) {
+		perror("RosterClient:");
+		return -1;
+	}
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+	// Step 2: Open the UDP socket, or the TCP connection pools
+	if (options.udp) {
+		udpFd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (udpFd < 0) {
+			perror("RosterClient socket:");
+			return -1;
+		}
+		fcntl(udpFd, F_SETFL, fcntl(udpFd, F_GETFL) | O_NONBLOCK);
+		// Room for a full window of requests and replies
+		int bufBytes = 4 << 20;
+		setsockopt(udpFd, SOL_SOCKET, SO_RCVBUF, &bufBytes, sizeof(bufBytes));
+		setsockopt(udpFd, SOL_SOCKET, SO_SNDBUF, &bufBytes, sizeof(bufBytes));
+		ev.events = EPOLLIN;
+		ev.data.ptr = &udpFd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, udpFd, &ev);
+	} else {
+		for (unsigned int s = 0; s < servers.size(); s++) {
+			for (int c = 0; c < options.connectionsPerServer; c++) {
+				int fd = socket(AF_INET, SOCK_STREAM, 0);
+				if (fd < 0 || ::connect(fd, (const sockaddr *) &servers[s], sizeof(sockaddr_in)) != 0) {
+					perror("RosterClient connect:");
+					if (fd >= 0) close(fd);
+					return -1;
+				}
+				// Requests are batched by the I/O thread already
+				int one = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+				Connection * conn = new Connection;
+				conn->fd = fd;
+				conn->shard = s;
+				conn->writing = false;
+				pools[s].push_back(conn);
+
+				ev.events = EPOLLIN;
+				ev.data.ptr = conn;
+				epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+			}
+		}
+	}
+
+	// Step 3: Start the I/O thread
+	if (pthread_create(&ioThread, NULL, runIo, this) != 0) {
+		perror("RosterClient thread:");
+		return -1;
+	}
+	started = true;
+	return 0;
+}
+
+
+// REQUESTS
+
+void RosterClient::request(const std::string & command, const ReplyCallback & callback) {
+	Request * r = new Request;
+	r->command = command;
+	r->callback = callback;
+	std::string groupId = routingKey(command);
+	r->shard = ring.shardFor(groupId);
+	r->lane = hash64(groupId);
+	r->id = 0;
+	r->deadline = 0;
+	r->retries = 0;
+	if (cache != NULL && r->callback && throughCache(r)) {
+		delete r;
+		return;
+	}
+
+	// Only the first request queued since the I/O thread last looked needs to wake it
+	pthread_mutex_lock(&m);
+	if (stopping || !started) {
+		pthread_mutex_unlock(&m);
+		fail(r);
+		return;
+	}
+	queued.push_back(r);
+	bool wake = !wakePending;
+	wakePending = true;
+	pthread_mutex_unlock(&m);
+
+	if (wake) {
+		uint64_t one = 1;
+		write(wakeFd, &one, sizeof(one));
+	}
+}
+
+std::future<ClientReply> RosterClient::request(const std::string & command) {
+	std::shared_ptr<std::promise<ClientReply> > promise(new std::promise<ClientReply>());
+	request(command, [promise](const ClientReply & reply) {
+		promise->set_value(reply);
+	});
+	return promise->get_future();
+}
+
+void RosterClient::get(const std::string & groupId, const std::string & studentId, const ReplyCallback & callback) {
+	request("GET " + groupId + " " + studentId, callback);
+}
+
+std::future<ClientReply> RosterClient::get(const std::string & groupId, const std::string & studentId) {
+	return request("GET " + groupId + " " + studentId);
+}
+
+void RosterClient::put(const std::string & groupId, const std::string & studentId, const std::string & studentName, const ReplyCallback & callback) {
+	request("PUT " + groupId + " " + studentId + " " + studentName, callback);
+}
+
+std::future<ClientReply> RosterClient::put(const std::string & groupId, const std::string & studentId, const std::string & studentName) {
+	return request("PUT " + groupId + " " + studentId + " " + studentName);
+}
+
+void RosterClient::del(const std::string & groupId, const std::string & studentId, const ReplyCallback & callback) {
+	request("DEL " + groupId + " " + studentId, callback);
+}
+
+std::future<ClientReply> RosterClient::del(const std::string & groupId, const std::string & studentId) {
+	return request("DEL " + groupId + " " + studentId);
+}
+
+void RosterClient::stopServers() {
+	// One request per server, without a callback: no reply is expected
+	pthread_mutex_lock(&m);
+	if (stopping || !started) {
+		pthread_mutex_unlock(&m);
+		return;
+	}
+	for (unsigned int s = 0; s < servers.size(); s++) {
+		Request * r = new Request;
+		r->command = "STOP";
+		r->shard = s;
+		r->lane = 0;
+		r->id = 0;
+		r->deadline = 0;
+		r->retries = 0;
+		queued.push_back(r);
+	}
+	bool wake = !wakePending;
+	wakePending = true;
+	pthread_mutex_unlock(&m);
+
+	if (wake) {
+		uint64_t one = 1;
+		write(wakeFd, &one, sizeof(one));
+	}
+}
+
+ClientCacheStats RosterClient::cacheStats() const {
+	if (cache == NULL) {
+		ClientCacheStats none = {0, 0, 0, 0};
+		return none;
+	}
+	return cache->getStats();
+}
+
+void RosterClient::fail(Request * request) {
+	if (request->callback) {
+		ClientReply reply = {-1, ""};
+		request->callback(reply);
+	}
+	delete request;
+}
+
+
+// CACHE
+
+// Answers a GET from the cache if it can; otherwise prefixes the request
+// with the version known for its server, and has its reply (run on the I/O
+// thread) strip the version notice, and cache a GET's name or not found error
+// Returns true if the request was answered
+bool RosterClient::throughCache(Request * request) {
+	// Step 1: Leave commands that are tagged or versioned already alone
+	InputBuffer inputBuffer(request->command);
+	if (!inputBuffer.next() || !inputBuffer.getTag().empty() || inputBuffer.hasVersion()) {
+		return false;
+	}
+	bool update = inputBuffer.hasPut() || inputBuffer.hasDel();
+	std::string key, notFound;
+	if (inputBuffer.hasGet()) {
+		key = inputBuffer.getGroupId() + " " + inputBuffer.getStudentId();
+		notFound = notFoundError(inputBuffer.getGroupId(), inputBuffer.getStudentId());
+	}
+
+	// Step 2: Look the key up
+	ClientCache * cache = this->cache;
+	unsigned int shard = request->shard;
+	if (!key.empty()) {
+		ClientReply reply = {0, ""};
+		if (cache->lookup(shard, key, nowMillis(), reply.reply)) {
+			request->callback(reply);
+			return true;
+		}
+	}
+
+	// Step 3: Send it, with the version its reply is cached against
+	if (update) {
+		cache->beginUpdate(shard);
+	}
+	uint64_t version = cache->version(shard);
+	std::stringstream ss;
+	ss << "!" << version << " " << request->command;
+	request->command = ss.str();
+
+	ReplyCallback callback = request->callback;
+	request->callback = [cache, shard, key, notFound, update, version, callback](const ClientReply & reply) {
+		ClientReply stripped = reply;
+		uint64_t replyVersion = version;
+		if (reply.status == 0 && reply.reply.compare(0, 9, "!VERSION ") == 0) {
+			size_t eol = reply.reply.find('\n');
+			replyVersion = strtoull(reply.reply.c_str() + 9, NULL, 10);
+			stripped.reply = eol == std::string::npos ? "" : reply.reply.substr(eol + 1);
+			cache->learn(shard, replyVersion);
+		}
+		if (update) {
+			cache->endUpdate(shard);
+		} else if (!key.empty() && reply.status == 0
+			&& (stripped.reply == notFound || stripped.reply.compare(0, 5, "ERROR") != 0)) {
+			cache->insert(shard, key, stripped.reply, replyVersion, nowMillis());
+		}
+		callback(stripped);
+	};
+	return false;
+}
+
+
+// I/O THREAD
+
+void * RosterClient::runIo(void * self) {
+	((RosterClient *) self)->ioLoop();
+	return NULL;
+}
+
+void RosterClient::ioLoop() {
+	epoll_event events[MAX_EVENTS];
+	int timeout = -1;
+
+	while (1) {
+		int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			perror("RosterClient epoll_wait:");
+			return;
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == NULL) {
+				uint64_t count;
+				read(wakeFd, &count, sizeof(count));
+				// Whatever was queued before closing (such as STOP) still goes out
+				if (drainQueue()) {
+					return;
+				}
+			} else if (events[i].data.ptr == &udpFd) {
+				readUdp();
+			} else {
+				Connection * conn = (Connection *) events[i].data.ptr;
+				bool ok = conn->fd >= 0;
+				if (ok && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+					ok = readTcp(conn);
+				}
+				if (ok && (events[i].events & EPOLLOUT)) {
+					ok = writeTcp(conn);
+				}
+				if (!ok) {
+					closeTcp(conn);
+				}
+			}
+		}
+
+		if (options.udp) {
+			timeout = expireUdp();
+		}
+	}
+}
+
+// Sends everything the calling threads queued, batched per connection or datagram
+// Returns true if the client is closing
+bool RosterClient::drainQueue() {
+	std::vector<Request *> batch;
+	pthread_mutex_lock(&m);
+	batch.swap(queued);
+	wakePending = false;
+	bool stop = stopping;
+	pthread_mutex_unlock(&m);
+
+	for (size_t i = 0; i < batch.size(); i++) {
+		if (options.udp) {
+			sendUdp(batch[i]);
+		} else {
+			sendTcp(batch[i]);
+		}
+	}
+
+	for (unsigned int s = 0; s < servers.size(); s++) {
+		if (options.udp) {
+			flushUdp(s);
+			continue;
+		}
+		for (size_t c = 0; c < pools[s].size(); c++) {
+			Connection * conn = pools[s][c];
+			if (conn->fd >= 0 && !conn->out.empty() && !conn->writing && !writeTcp(conn)) {
+				closeTcp(conn);
+			}
+		}
+	}
+	return stop;
+}
+
+
+// TCP
+
+void RosterClient::sendTcp(Request * request) {
+	// Requests for one group always take the same (live) connection, so
+	// that they are executed in the order they were made
+	Connection * conn = NULL;
+	std::vector<Connection *> & pool = pools[request->shard];
+	for (size_t c = 0; c < pool.size() && !conn; c++) {
+		Connection * candidate = pool[(request->lane + c) % pool.size()];
+		if (candidate->fd >= 0) {
+			conn = candidate;
+		}
+	}
+	if (!conn) {
+		fail(request);
+		return;
+	}
+
+	conn->out += request->command;
+	conn->out += '\n';
+	if (request->callback) {
+		conn->inFlight.push_back(request);
+	} else {
+		delete request;
+	}
+}
+
+bool RosterClient::readTcp(Connection * conn) {
+	char buf[READ_BUF_LEN];
+	while (1) {
+		int l = read(conn->fd, buf, sizeof(buf));
+		if (l < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return false;
+		}
+		if (l == 0) {
+			return false;
+		}
+		conn->in.append(buf, l);
+		if (l < (int) sizeof(buf)) break;
+	}
+
+	// Every reply ends with a NUL, and replies come back in request order
+	size_t start = 0;
+	while (1) {
+		size_t end = conn->in.find('\0', start);
+		if (end == std::string::npos) break;
+		ClientReply reply = {0, conn->in.substr(start, end - start)};
+		start = end + 1;
+
+		if (!conn->inFlight.empty()) {
+			Request * r = conn->inFlight.front();
+			conn->inFlight.pop_front();
+			r->callback(reply);
+			delete r;
+		}
+	}
+	conn->in.erase(0, start);
+	return true;
+}
+
+bool RosterClient::writeTcp(Connection * conn) {
+	while (!conn->out.empty()) {
+		int l = write(conn->fd, conn->out.data(), conn->out.length());
+		if (l < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return false;
+		}
+		conn->out.erase(0, l);
+	}
+
+	// Only wait for writability while requests are pending
+	bool writing = !conn->out.empty();
+	if (writing != conn->writing) {
+		epoll_event ev;
+		ev.events = writing ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+		ev.data.ptr = conn;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+		conn->writing = writing;
+	}
+	return true;
+}
+
+// Closes a connection for good; its requests fail, later ones use the rest of the pool
+void RosterClient::closeTcp(Connection * conn) {
+	if (conn->fd >= 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	conn->out.clear();
+	while (!conn->inFlight.empty()) {
+		fail(conn->inFlight.front());
+		conn->inFlight.pop_front();
+	}
+}
+
+
+// UDP
+
+void RosterClient::sendUdp(Request * request) {
+	unsigned int shard = request->shard;
+	std::string line;
+	if (request->callback) {
+		if (!request->id) {
+			if (udpInFlight.size() >= options.udpWindow) {
+				udpBacklog.push_back(request);
+				return;
+			}
+			request->id = nextId++;
+			udpInFlight[request->id] = request;
+		}
+		std::stringstream ss;
+		ss << "#" << request->id << " " << request->command << "\n";
+		line = ss.str();
+
+		request->deadline = nowMillis() + options.udpTimeoutMillis;
+		udpTimeouts.push_back(std::make_pair(request->deadline, request->id));
+	} else {
+		line = request->command + "\n";
+		delete request;
+	}
+
+	// Requests for one server share a datagram, up to CLIENT_DATAGRAM_BYTES
+	if (!udpOut[shard].empty() && udpOut[shard].length() + line.length() + 1 > CLIENT_DATAGRAM_BYTES) {
+		flushUdp(shard);
+	}
+	udpOut[shard] += line;
+}
+
+// Sends waiting requests while there is room in the window
+void RosterClient::fillUdpWindow() {
+	while (!udpBacklog.empty() && udpInFlight.size() < options.udpWindow) {
+		Request * r = udpBacklog.front();
+		udpBacklog.pop_front();
+		sendUdp(r);
+	}
+}
+
+void RosterClient::flushUdp(unsigned int shard) {
+	if (udpOut[shard].empty()) {
+		return;
+	}
+	// The datagram ends with a NUL, like the clients' single requests
+	udpOut[shard] += '\0';
+	// A datagram the socket buffer can't take is lost like any other,
+	// and its requests will be sent again
+	sendto(udpFd, udpOut[shard].data(), udpOut[shard].length(), 0,
+		(const sockaddr *) &servers[shard], sizeof(sockaddr_in));
+	udpOut[shard].clear();
+}
+
+void RosterClient::readUdp() {
+	char buf[READ_BUF_LEN];
+	while (1) {
+		int l = recvfrom(udpFd, buf, sizeof(buf), 0, NULL, NULL);
+		if (l < 0) {
+			if (errno == EINTR) continue;
+			return;
+		}
+
+		// "#<id> <reply>"; replies to requests already answered (or
+		// given up on) are duplicates of a retransmission
+		std::string datagram(buf, strnlen(buf, l));
+		if (datagram.empty() || datagram[0] != '#') {
+			continue;
+		}
+		size_t space = datagram.find(' ');
+		uint64_t id = strtoull(datagram.c_str() + 1, NULL, 10);
+		std::unordered_map<uint64_t, Request *>::iterator it = udpInFlight.find(id);
+		if (it == udpInFlight.end()) {
+			continue;
+		}
+		Request * r = it->second;
+		udpInFlight.erase(it);
+
+		ClientReply reply = {0, space == std::string::npos ? "" : datagram.substr(space + 1)};
+		r->callback(reply);
+		delete r;
+	}
+}
+
+// Resends (or gives up on) the requests whose timeout has passed
+// Returns the milliseconds until the next timeout, or -1 if there is none
+int RosterClient::expireUdp() {
+	uint64_t now = nowMillis();
+	while (!udpTimeouts.empty() && udpTimeouts.front().first <= now) {
+		std::pair<uint64_t, uint64_t> timeout = udpTimeouts.front();
+		udpTimeouts.pop_front();
+
+		std::unordered_map<uint64_t, Request *>::iterator it = udpInFlight.find(timeout.second);
+		if (it == udpInFlight.end() || it->second->deadline != timeout.first) {
+			// Answered, or already sent again
+			continue;
+		}
+		Request * r = it->second;
+		if (r->retries >= options.udpRetries) {
+			udpInFlight.erase(it);
+			fail(r);
+			continue;
+		}
+		r->retries++;
+		sendUdp(r);
+	}
+
+	fillUdpWindow();
+	for (unsigned int s = 0; s < servers.size(); s++) {
+		flushUdp(s);
+	}
+	if (udpTimeouts.empty()) {
+		return -1;
+	}
+	return udpTimeouts.front().first - now;
+}
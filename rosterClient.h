@@ -0,0 +1,159 @@
+#ifndef ROSTER_CLIENT_H
+#define ROSTER_CLIENT_H
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "clientCache.h"
+#include "shard.h"
+
+// ROSTER CLIENT
+// Asynchronous client library for the roster servers
+//
+// Requests are queued by the calling thread and sent by one I/O thread
+// (epoll), which also runs the callbacks. With several servers, each
+// request goes to the server owning its group ID (see ShardRing).
+//
+// TCP: a pool of connections per server, each group ID sticking to one of
+// them so that a group's requests are executed in order. Requests are
+// pipelined (many in flight per connection, replies come back in order,
+// each ending with a NUL) and everything queued for a connection goes out
+// in one write().
+//
+// UDP: one socket. Every request carries a "#<id>" tag that the server
+// echoes, so replies can arrive in any order. Requests for the same server
+// are packed into datagrams of up to CLIENT_DATAGRAM_BYTES, and a request
+// that gets no reply within the timeout is sent again
+// (so a retried DEL may report that the student does not exist).
+// At most udpWindow requests are outstanding; the rest wait their turn, as
+// a flood of replies would overflow the socket buffers and be lost
+//
+// With cacheEntries, GET replies are cached (see clientCache.h): a GET for
+// a key asked for recently is answered at once, without a round trip, and
+// every other request carries the roster version the cache holds for its
+// server
+
+#define CLIENT_DATAGRAM_BYTES 1400
+
+struct ClientOptions {
+	bool udp;						// use UDP instead of TCP
+	int connectionsPerServer;		// TCP pool size (default 2)
+	int udpTimeoutMillis;			// UDP retransmission timeout (default 200)
+	int udpRetries;					// UDP retransmissions before giving up (default 5)
+	size_t udpWindow;				// UDP requests awaiting a reply at once (default 1024)
+	size_t cacheEntries;			// GET replies cached (default 0: no cache)
+	int cacheTtlMillis;				// how long a cached reply is good for (default 10000)
+
+	ClientOptions(): udp(false), connectionsPerServer(2), udpTimeoutMillis(200), udpRetries(5), udpWindow(1024),
+		cacheEntries(0), cacheTtlMillis(10000) {}
+};
+
+// The outcome of a request: status is 0 when reply holds the server's
+// reply, -1 when there will be none (connection lost, timed out, closing)
+struct ClientReply {
+	int status;
+	std::string reply;
+};
+
+typedef std::function<void (const ClientReply &)> ReplyCallback;
+
+class RosterClient {
+	struct Request {
+		std::string command;
+		ReplyCallback callback;
+		unsigned int shard;			// server
+		uint64_t lane;				// picks the TCP connection (by group ID)
+		uint64_t id;				// UDP tag
+		uint64_t deadline;			// UDP retransmission time (ms)
+		int retries;
+	};
+
+	struct Connection {
+		int fd;
+		unsigned int shard;
+		std::string in, out;
+		std::deque<Request *> inFlight;
+		bool writing;				// waiting for EPOLLOUT
+	};
+
+	std::vector<sockaddr_in> servers;
+	ClientOptions options;
+	ShardRing ring;
+	ClientCache * cache;
+
+	int epfd;
+	int wakeFd;						// eventfd: requests were queued
+	pthread_t ioThread;
+	bool started;
+
+	// Shared with the calling threads
+	pthread_mutex_t m;
+	std::vector<Request *> queued;
+	bool wakePending;
+	bool stopping;
+
+	// Owned by the I/O thread
+	std::vector<std::vector<Connection *> > pools;
+	int udpFd;
+	uint64_t nextId;
+	std::unordered_map<uint64_t, Request *> udpInFlight;
+	std::deque<Request *> udpBacklog;						// waiting for room in the window
+	std::deque<std::pair<uint64_t, uint64_t> > udpTimeouts;	// (deadline, id) in deadline order
+	std::vector<std::string> udpOut;						// datagram being packed per server
+
+	bool throughCache(Request * request);
+	static void * runIo(void * self);
+	void ioLoop();
+	bool drainQueue();
+	void sendTcp(Request * request);
+	bool readTcp(Connection * conn);
+	bool writeTcp(Connection * conn);
+	void closeTcp(Connection * conn);
+	void sendUdp(Request * request);
+	void fillUdpWindow();
+	void flushUdp(unsigned int shard);
+	void readUdp();
+	int expireUdp();
+	static void fail(Request * request);
+
+public:
+	RosterClient(const std::vector<sockaddr_in> & servers, const ClientOptions & options = ClientOptions());
+
+	// Fails every request still outstanding, then closes the connections
+	~RosterClient();
+
+	// Connects to every server and starts the I/O thread
+	// Returns 0 on success and -1 on error
+	int connect();
+
+	// Sends one command line (such as "GET <group> <student>") to the server
+	// owning its group ID; callback runs on the I/O thread, or on the
+	// calling thread before request() returns for a GET answered from the cache
+	void request(const std::string & command, const ReplyCallback & callback);
+	std::future<ClientReply> request(const std::string & command);
+
+	void get(const std::string & groupId, const std::string & studentId, const ReplyCallback & callback);
+	std::future<ClientReply> get(const std::string & groupId, const std::string & studentId);
+	void put(const std::string & groupId, const std::string & studentId, const std::string & studentName, const ReplyCallback & callback);
+	std::future<ClientReply> put(const std::string & groupId, const std::string & studentId, const std::string & studentName);
+	void del(const std::string & groupId, const std::string & studentId, const ReplyCallback & callback);
+	std::future<ClientReply> del(const std::string & groupId, const std::string & studentId);
+
+	// Sends STOP to every server (there is no reply)
+	void stopServers();
+
+	// The cache's counters (all 0 without a cache)
+	ClientCacheStats cacheStats() const;
+};
+
+// Resolves "<server name/ip> <server port>"
+// Returns 0 on success and -1 on error
+int resolveServer(const char * host, const char * port, sockaddr_in * addr);
+
+#endif
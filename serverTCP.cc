@@ -1,358 +1,314 @@
 #include <arpa/inet.h>
 #include <errno.h>
-#include <ifaddrs.h>
+#include <fcntl.h>
 #include <iostream>
-#include <map>
-#include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
-#include <pthread.h>
-#include <sstream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <vector>
+#include "common.h"
+#include "handoff.h"
+#include "reactor.h"
+#include "roster.h"
+#include "shmTransport.h"
+#include "tcpHandler.h"
+#include "trace.h"
 #include "mybind.c"
 #include "unistd.h"
 
-#define SELECT_WAIT_SECS 0
-#define SELECT_WAIT_MICROSECS 500000
-
-// STRING UTILITIES 
-
-std::string trim(std::string line) {
-	int left, right;
-	for (left = 0; left < line.length() && isspace(line[left]); left++);
-	for (right = line.length() - 1; right >= left && isspace(line[right]); right--);
-	if (right >= left) {
-		return line.substr(left, right - left + 1);
-	}
-	return "";
-}
-
-bool isNumeric(std::string str) {
-	if (!str.length()) {
-		return false;
+/*
+	Usage: server [--reactors] [--handoff <path>] [--shm <path>] [--trace <n>] [<connections>] [<roster options>]
+
+	--reactors        serve from one pinned reactor per CPU
+	--handoff <path>  take over the sockets of the server listening on
+	                  <path> (if any), then listen there for the next upgrade
+	                  (not with --wal)
+	--shm <path>      serve clients on this host through shared memory,
+	                  handed out on the Unix socket <path> (see shmTransport.h)
+	--trace <n>       time the stages of one request in every <n>
+	                  (see trace.h)
+	<connections>     --max-connections, --conn-queue: bound the
+	                  TCP sessions served and waiting
+	                  --idle-timeout, --read-timeout, --write-timeout:
+	                  close silent or stuck clients (see tcpHandler.h)
+	<roster options>  --disk, --cache-mb: pick the roster engine
+	                  --wal, --sync-us, --checkpoint-mb: log PUT/DEL
+	                  --find-limit: records per FIND reply, the rest
+	                  paged with AFTER (0: no FIND)
+	                  --name-index: build the FIND index (default off
+	                  with --disk, --huge-pages, --numa-replicate)
+	                  --student-index: build the WHERE index (default
+	                  off with --disk)
+	                  --huge-pages, --numa-replicate: serve a read-only
+	                  flat roster on huge pages, or one per NUMA node;
+	                  the indexes and the default (writable) roster stay
+	                  on normal pages (see roster.h)
+*/
+
+// Takes over the listening sockets of the server at handoffPath, if any
+// Returns the connection to the old server, or -1 for a fresh start
+int takeoverListeners(const std::string & handoffPath, std::vector<int> & listeners, sockaddr_in * addr) {
+	if (handoffPath.empty()) {
+		return -1;
 	}
-	for (unsigned int i = 0; i < str.length(); i++) {
-		if (!isdigit(str[i])) {
-			return false;
-		}
+	int peer = takeover(handoffPath, listeners, 256);
+	if (peer < 0) {
+		return -1;
 	}
-	return true;
-}
 
-std::string & tolower(std::string & str) {
-	for (int i = 0; i < str.length(); i++) {
-		if (isupper(str[i])) {
-			str[i] = tolower(str[i]);
+	socklen_t addrLen = sizeof(sockaddr_in);
+	for (unsigned int i = 0; i < listeners.size(); i++) {
+		if (socketType(listeners[i]) != SOCK_STREAM) {
+			std::cerr << "Handoff: " << handoffPath << " is not serving TCP" << std::endl;
+			for (unsigned int j = 0; j < listeners.size(); j++) close(listeners[j]);
+			listeners.clear();
+			close(peer);
+			return -1;
 		}
 	}
-	return str;
+	getsockname(listeners[0], (sockaddr *) addr, &addrLen);
+	return peer;
 }
 
 
-// GROUP MAP
-// student info is stored in this map (groupId -> studentId -> studentName)
+// REACTOR MODE
+// One pinned reactor per CPU, each with its own SO_REUSEPORT listener
 
-typedef std::map<std::string, std::map<std::string, std::string> > GroupMap;
-
-// read stdin input into the groupMap data structure
-std::istream & operator>>(std::istream & in, GroupMap & groupMap) {
-	std::string line;
-	std::string groupId;
-
-	while (std::getline(in, line)) {
-		std::stringstream ss(line);
-		std::string studentId;
-		ss >> studentId >> std::ws;
+int runReactors(const std::string & handoffPath, const std::string & shmPath, const ConnectionOptions & connectionOptions, const RosterOptions & rosterOptions) {
+	std::vector<int> cpus = availableCpus();
+	std::vector<int> listeners;
+	sockaddr_in addr;
 
-		if (tolower(studentId) == "group") {
-			// this is a group ID declaration
-			// the next token will be the group ID
-			ss >> groupId;
-		} else {
-			// extract the first token as studentId
-			// the remainder of the line is the studentName
-			std::string studentName;
-			std::getline(ss, studentName);
-			groupMap[groupId][studentId] = studentName;
+	// Step 1: Take over the previous server's listeners, or pick a
+	// free port and bind every listener to it
+	int peer = takeoverListeners(handoffPath, listeners, &addr);
+	if (peer < 0) {
+		int soc = socket(AF_INET, SOCK_DGRAM, 0);
+		if (soc < 0 || getUnboundSockAddr(soc, &addr) < 0) {
+			return 1;
 		}
-	}
-
-	return in;
-}
-
-
-// INPUT BUFFER
-// Class for translating text sent by the client into server instructions
-
-class InputBuffer {
-	std::stringstream ss;
-	std::string tok;
-	std::vector<std::string> get;
-
-public:
-	InputBuffer(const std::string & str): ss(str) {}
-
-	// Read the next command (contained in the next line of ss)
-	// If there are no more lines to be read, return false; otherwise return true
-	bool next() {
-		get.clear();
+		close(soc);
+		addr.sin_port = 0;
 
-		std::string line;
-		if (!std::getline(ss, line)) {
-			return false;
+		int probe = reservePort(&addr);
+		if (probe < 0) {
+			return 1;
 		}
-
-		std::stringstream line_ss(line);
-		if (!(line_ss >> tok)) {
-			tok = "";
-		} else {
-			// Tokenize GET commands
-			if (tolower(tok) == "get") {
-				while (line_ss >> tok) {
-					get.push_back(tok);
-				}
+		for (unsigned int i = 0; i < cpus.size(); i++) {
+			int listener = reusePortListener(&addr);
+			if (listener < 0) {
+				for (unsigned int j = 0; j < listeners.size(); j++) close(listeners[j]);
+				close(probe);
+				return 1;
 			}
-			tok = trim(tolower(line));
+			listeners.push_back(listener);
 		}
-		return true;
+		close(probe);
 	}
 
-	bool stop() const {
-		return tok == "stop";
-	}
-	bool stopSession() const {
-		return stop() || (tok == "stop_session");
-	}
-	bool hasGet() const {
-		return isNumeric(getGroupId()) && isNumeric(getStudentId());
-	}
-	bool error() const {
-		return !tok.empty() && !stopSession() && !hasGet();
-	}
+	std::cout << inet_ntoa(addr.sin_addr) << " " << ntohs(addr.sin_port) << std::endl;
 
-	std::string getGroupId() const {
-		return get.size() == 2 ? get[0] : "";
-	}
-	std::string getStudentId() const {
-		return get.size() == 2 ? get[1] : "";
+	// Step 2: Construct the roster
+	Roster * roster = loadRoster(std::cin, rosterOptions);
+	if (roster == NULL) {
+		for (unsigned int i = 0; i < listeners.size(); i++) close(listeners[i]);
+		if (peer >= 0) close(peer);
+		return 1;
 	}
-};
-
-
-// CLIENT THREAD
-// everything that identifies and will be used by a client-serving thread
-
-struct ClientThread {
-	pthread_t id;						// thread ID
-	int sockfd;							// client socket
-	const GroupMap * groupMap;			// pointer to GroupMap
-	char * end_session;					// shared memory, flag for STOP signal
-	pthread_mutex_t * m_end_session;	// mutex for end_session
-
-	ClientThread(
-		int sockfd,
-		const GroupMap * groupMap,
-		char * end_session,
-		pthread_mutex_t * m_end_session
-	):
-		sockfd(sockfd),
-		groupMap(groupMap),
-		end_session(end_session),
-		m_end_session(m_end_session)
-	{}
-};
-
-// Internal logic for client threads
-void _handle(ClientThread * ct) {
-	char buf[4096];
 
-	while (1) {
-		// Check whether the STOP signal has been sent
-		pthread_mutex_lock(ct->m_end_session);
-		int _end_session = *ct->end_session;
-		pthread_mutex_unlock(ct->m_end_session);
-		if (_end_session) {
-			return;
+	// Step 3: Start one reactor per listener
+	// (a handed-off server keeps its predecessor's listeners, so that
+	// no connection queued on one of them is lost)
+	EndSession endSession;
+	std::vector<Reactor *> reactors;
+	std::vector<int> served;			// the listeners of running reactors
+	for (unsigned int i = 0; i < listeners.size(); i++) {
+		Reactor * reactor = new Reactor(cpus[i % cpus.size()], listeners[i], roster, &endSession, connectionOptions);
+		if (reactor->spawn() < 0) {
+			close(listeners[i]);
+			delete reactor;
+		} else {
+			reactors.push_back(reactor);
+			served.push_back(listeners[i]);
 		}
+	}
 
-		// Use select() here in order to regularly check whether STOP has been sent
+	// Step 4: Serve handoffs and shared memory clients until STOP, or
+	// until a new server takes over (without a reactor, the old server
+	// is left serving)
+	if (peer >= 0 && !reactors.empty()) {
+		handoffReady(peer);
+	} else if (peer >= 0) {
+		close(peer);
+	}
+	// (only the listeners still open go to the next server)
+	HandoffListener handoff(handoffPath, served);
+	bool handoffs = !served.empty() && !handoffPath.empty() && handoff.listen() == 0;
+	ShmListener shm(shmPath, roster, &endSession, connectionOptions);
+	bool shmClients = !shmPath.empty() && shm.listen() == 0;
+	while ((handoffs || shmClients) && !endSession.isSet()) {
 		fd_set fds;
 		FD_ZERO(&fds);
-		FD_SET(ct->sockfd, &fds);
+		int maxFd = shm.fill(&fds, handoff.fill(&fds, -1));
 		timeval tv = {SELECT_WAIT_SECS, SELECT_WAIT_MICROSECS};
-
-		int retval = select(ct->sockfd + 1, &fds, NULL, NULL, &tv);
-		if (retval < 0) {
-			// Error
-			perror("Select:");
-			return;
-		} else if (retval == 0) {
-			// Nothing to be read from socket
+		if (select(maxFd + 1, &fds, NULL, NULL, &tv) <= 0) {
 			continue;
 		}
-
-		// Read from client socket and construct InputBuffer
-		int l = read(ct->sockfd, buf, 4095);
-		buf[l] = '\0';
-		std::string bufstr(buf);
-		InputBuffer inputBuffer(bufstr);
-
-		while (inputBuffer.next()) {
-			// Error case
-			if (inputBuffer.error()) {
-				std::string errStr = "ERROR_INVALID_INPUT";
-				write(ct->sockfd, errStr.c_str(), errStr.length());
-				continue;
-			}
-
-			// STOP case (stop() == true implies stopSession() == true)
-			if (inputBuffer.stop()) {
-				// Communicate to other threads that STOP has been sent
-				pthread_mutex_lock(ct->m_end_session);
-				*ct->end_session = 1;
-				pthread_mutex_unlock(ct->m_end_session);
-			}
-			if (inputBuffer.stopSession()) {
-				return;
-			}
-
-			// GET case
-			if (inputBuffer.hasGet()) {
-				std::string groupId = inputBuffer.getGroupId();
-				std::string studentId = inputBuffer.getStudentId();
-				// group corresponds to groupMap[groupId]
-				GroupMap::const_iterator group = ct->groupMap->find(groupId);
-				// Check if groupMap[groupId] exists
-				// and groupMap[groupId][studentId] exists
-				if (group != ct->groupMap->end() && group->second.find(studentId) != group->second.end()) {
-					std::string studentName = group->second.find(studentId)->second;
-					write(ct->sockfd, studentName.c_str(), studentName.length());
-				} else {
-					// groupMap[groupId][studentId] does not exist
-					std::stringstream err;
-					err << "ERROR_" << groupId << "_" << studentId;
-					std::string errStr = err.str();
-					write(ct->sockfd, errStr.c_str(), errStr.length());
-				}
+		shm.handle(&fds);
+		if (handoff.handle(&fds)) {
+			// Stop accepting and exit once our connections are done
+			for (unsigned int i = 0; i < reactors.size(); i++) {
+				reactors[i]->drain();
 			}
+			break;
 		}
 	}
-}
 
-// The handler acting as the main method for the client threads
-// Most of the work is delegated to _handle
-void * handle(void * arg) {
-	ClientThread * ct = (ClientThread *) arg;
-	_handle(ct);
-	close(ct->sockfd);
-	return NULL;
+	// Step 5: Cleanup, join all reactors
+	shm.join();
+	if (shm.rejected || shm.expired || shm.corrupted) {
+		std::cerr << "Shared memory: rejected " << shm.rejected << " expired " << shm.expired
+			<< " corrupted " << shm.corrupted << std::endl;
+	}
+	uint64_t expired = 0;
+	for (unsigned int i = 0; i < reactors.size(); i++) {
+		reactors[i]->join();
+		expired += reactors[i]->expired;
+		delete reactors[i];
+	}
+	if (expired) {
+		std::cerr << "TCP: expired " << expired << std::endl;
+	}
+	delete roster;
+	return reactors.empty() ? 1 : 0;
 }
 
 
-// SOCKET UTILITIES
-
-// Provides a sockaddr (complete with IP address)
-// that can be used with AF_INET socket "soc"
-// Returns 0 on success and -1 on error
-int getUnboundSockAddr(int soc, sockaddr_in * addr) {
-	ifaddrs * addrs;
+// MAIN
 
-	// Step 1: Get ifaddrs for all network interfaces
-	if (getifaddrs(&addrs) < 0) {
-		perror("getifaddrs():");
-		return -1;
+int main(int argc, char * argv[]) {
+	bool reactors = false;
+	std::string handoffPath;
+	std::string shmPath;
+	unsigned int traceEvery = 0;
+	ConnectionOptions connectionOptions;
+	RosterOptions rosterOptions;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--reactors") {
+			reactors = true;
+		} else if (arg == "--handoff" && i + 1 < argc) {
+			handoffPath = argv[++i];
+		} else if (arg == "--shm" && i + 1 < argc) {
+			shmPath = argv[++i];
+		} else if (arg == "--trace" && i + 1 < argc && isNumeric(argv[i + 1])) {
+			traceEvery = strtoul(argv[++i], NULL, 10);
+		} else if (!parseConnectionOption(argc, argv, i, connectionOptions) && !parseRosterOption(argc, argv, i, rosterOptions)) {
+			std::cerr << "usage : " << argv[0] << " [--reactors] [--handoff <path>] [--shm <path>] [--trace <n>] " << CONNECTION_USAGE << " " << ROSTER_USAGE << std::endl;
+			return 1;
+		}
 	}
 
-	// Step 2: Select an open outbound AF_INET interface and get its name
-	std::string ifa_name;
-	for (ifaddrs * addrs_temp = addrs; addrs_temp != NULL; addrs_temp = addrs_temp->ifa_next) {
-		if (addrs_temp->ifa_name == NULL) continue;
-		if (!(addrs_temp->ifa_flags & (IFF_UP | IFF_BROADCAST))) continue;
-		if (addrs_temp->ifa_flags & IFF_LOOPBACK) continue;
-		if (addrs_temp->ifa_addr->sa_family != AF_INET) continue;
-		ifa_name = addrs_temp->ifa_name;
-		break;
+	// The new server replays the WAL while the old one still logs writes,
+	// which it would never see
+	if (!handoffPath.empty() && !rosterOptions.walDir.empty()) {
+		std::cerr << "--handoff can't be used with --wal" << std::endl;
+		return 1;
 	}
 
-	freeifaddrs(addrs);
-	if (!ifa_name.length()) {
-		std::cerr << "Could not find appropriate network device" << std::endl;
-		return -1;
+	// Before any thread starts, so that they all leave SIGUSR1 to the tracer
+	if (traceStart(traceEvery) < 0) {
+		return 1;
 	}
 
-	// Step 3: Get the IP address for the selected interface
-	ifreq ifr;
-	ifr.ifr_addr.sa_family = AF_INET;
-	strncpy(ifr.ifr_name, ifa_name.c_str(), IFNAMSIZ-1);
-	if (ioctl(soc, SIOCGIFADDR, &ifr) < 0) {
-		perror("ioctl:");
-		return -1;
+	if (reactors) {
+		return runReactors(handoffPath, shmPath, connectionOptions, rosterOptions);
 	}
 
-	// Step 4: Copy info from ioctl to the provided sockaddr pointer
-	*addr = *(sockaddr_in *)(&ifr.ifr_addr);
-	return 0;
-}
+	// Steps 1-4: Take over the previous server's listening sockets,
+	// or create a new one
+	// (a reactor server hands over one SO_REUSEPORT listener per reactor,
+	// each with its own accept queue: all of them are kept and served, so
+	// that no connection waiting in one is reset)
+	std::vector<int> listeners;
+	sockaddr_in addr;
+	int soc;
+	int peer = takeoverListeners(handoffPath, listeners, &addr);
+	if (peer >= 0) {
+		soc = listeners[0];
+	} else {
+		// Step 1: Create socket
+		soc = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (soc < 0) {
+			perror("Socket:");
+			return 1;
+		}
 
+		// Step 2: Get the address for an appropriate network interface
+		if (getUnboundSockAddr(soc, &addr) < 0) {
+			close(soc);
+			return 1;
+		}
 
-// MAIN
+		// Step 3: Bind socket to sockaddr
+		if (mybind(soc, &addr) < 0) {
+			perror("Bind:");
+			close(soc);
+			return 1;
+		}
 
-int main() {
-	// Step 1: Create socket
-	int soc = socket(AF_INET, SOCK_STREAM, 0);
-	
-	if (soc < 0) {
-		perror("Socket:");
-		return 1;
+		// Step 4: Open the socket to listen for incoming requests
+		if (listen(soc, 1000) < 0) {
+			perror("Listen:");
+			close(soc);
+			return 1;
+		}
+		listeners.push_back(soc);
 	}
 
-	// Step 2: Get the address for an appropriate network interface
-	sockaddr_in addr;
-	if (getUnboundSockAddr(soc, &addr) < 0) {
-		close(soc);
-		return 1;
+	// The sockets may be shared with another server during a handoff,
+	// so accept() must not block when the other one wins the connection
+	for (unsigned int i = 0; i < listeners.size(); i++) {
+		fcntl(listeners[i], F_SETFL, fcntl(listeners[i], F_GETFL) | O_NONBLOCK);
 	}
 
-	// Step 3: Bind socket to sockaddr
-	if (mybind(soc, &addr) < 0) {
-		perror("Bind:");
-		close(soc);
-		return 1;
-	}
+	std::cout << inet_ntoa(addr.sin_addr) << " " << ntohs(addr.sin_port) << std::endl;
 
-	// Step 4: Open the socket to listen for incoming requests
-	if (listen(soc, 1000) < 0) {
-		perror("Listen:");
-		close(soc);
+	// Step 5: Construct the roster
+	Roster * roster = loadRoster(std::cin, rosterOptions);
+	if (roster == NULL) {
+		for (unsigned int i = 0; i < listeners.size(); i++) close(listeners[i]);
+		if (peer >= 0) close(peer);
 		return 1;
 	}
 
-	std::cout << inet_ntoa(addr.sin_addr) << " " << ntohs(addr.sin_port) << std::endl;
-
-	// Step 5: Construct GroupMap
-	GroupMap groupMap;
-	std::cin >> groupMap;
-
-	char end_session = 0;
-	pthread_mutex_t m_end_session;
-	pthread_mutex_init(&m_end_session, NULL);
-
-	std::vector<ClientThread *> threads;
+	EndSession endSession;
+	TcpAcceptor acceptor(soc, roster, &endSession, connectionOptions);
 	int retCode = 0;
 
+	// Let the previous server go, and wait for our own successor
+	if (peer >= 0) {
+		handoffReady(peer);
+	}
+	HandoffListener handoff(handoffPath, listeners);
+	if (!handoffPath.empty()) {
+		handoff.listen();
+	}
+	ShmListener shm(shmPath, roster, &endSession, connectionOptions);
+	if (!shmPath.empty()) {
+		shm.listen();
+	}
+
 	while (1) {
 		// Step 6: Check whether STOP has been sent
-		pthread_mutex_lock(&m_end_session);
-		int _end_session = end_session;
-		pthread_mutex_unlock(&m_end_session);
-		if (_end_session) {
+		if (endSession.isSet()) {
 			break;
 		}
 
@@ -362,10 +318,15 @@ int main() {
 		// whether STOP has been sent)
 		fd_set fds;
 		FD_ZERO(&fds);
-		FD_SET(soc, &fds);
+		int maxFd = -1;
+		for (unsigned int i = 0; i < listeners.size(); i++) {
+			FD_SET(listeners[i], &fds);
+			maxFd = listeners[i] > maxFd ? listeners[i] : maxFd;
+		}
+		maxFd = shm.fill(&fds, handoff.fill(&fds, maxFd));
 		timeval tv = {SELECT_WAIT_SECS, SELECT_WAIT_MICROSECS};
 
-		int retval = select(soc + 1, &fds, NULL, NULL, &tv);
+		int retval = select(maxFd + 1, &fds, NULL, NULL, &tv);
 		if (retval < 0) {
 			// Error
 			perror("Select:");
@@ -376,29 +337,37 @@ int main() {
 			continue;
 		}
 
-		// Step 7: A client wants to connect, accept the connection
-		int clientSoc = accept(soc, NULL, NULL);
-		if (clientSoc < 0) {
-			perror("Accept:");
-			retCode = 1;
+		shm.handle(&fds);
+
+		// A new server has taken over: stop accepting, drain our clients
+		if (handoff.handle(&fds)) {
 			break;
 		}
 
-		// Step 8: Create new client thread for serving the new client
-		ClientThread * ct = new ClientThread(clientSoc, &groupMap, &end_session, &m_end_session);
-		if (pthread_create(&(ct->id), NULL, handle, ct) != 0) {
-			delete ct;
-		} else {
-			threads.push_back(ct);
+		// Step 8: A client wants to connect, accept the connection
+		// and create a new client thread for serving it
+		for (unsigned int i = 0; i < listeners.size() && !retCode; i++) {
+			if (FD_ISSET(listeners[i], &fds) && acceptor.acceptClient(listeners[i]) < 0) {
+				retCode = 1;
+			}
+		}
+		if (retCode) {
+			break;
 		}
 	}
 
 	// Step 9: Cleanup, join all client threads
-	close(soc);
-	for (unsigned int i = 0; i < threads.size(); ++i) {
-		pthread_join(threads[i]->id, NULL);
-		delete threads[i];
+	for (unsigned int i = 0; i < listeners.size(); i++) close(listeners[i]);
+	acceptor.join();
+	shm.join();
+	if (shm.rejected || shm.expired || shm.corrupted) {
+		std::cerr << "Shared memory: rejected " << shm.rejected << " expired " << shm.expired
+			<< " corrupted " << shm.corrupted << std::endl;
+	}
+	if (acceptor.rejected || acceptor.expired) {
+		std::cerr << "TCP: accepted " << acceptor.accepted << " rejected " << acceptor.rejected
+			<< " expired " << acceptor.expired << std::endl;
 	}
-	pthread_mutex_destroy(&m_end_session);
+	delete roster;
 	return retCode;
 }
@@ -0,0 +1,291 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <vector>
+#include "common.h"
+#include "handoff.h"
+#include "rateLimit.h"
+#include "roster.h"
+#include "shmTransport.h"
+#include "tcpHandler.h"
+#include "trace.h"
+#include "udpHandler.h"
+#include "mybind.c"
+#include "unistd.h"
+
+/*
+	Serves TCP and UDP clients from one process, on the same port,
+	with a single roster and request engine.
+	STOP received on either protocol shuts down both.
+
+	Usage: server [--handoff <path>] [--shm <path>] [--trace <n>] [<connections>] [<rate limits>] [<roster options>]
+
+	--handoff <path>  take over the sockets of the server listening on
+	                  <path> (if any), then listen there for the next upgrade
+	                  (not with --wal)
+	--shm <path>      serve clients on this host through shared memory,
+	                  handed out on the Unix socket <path> (see shmTransport.h)
+	--trace <n>       time the stages of one request in every <n>
+	                  (see trace.h)
+	<connections>     --max-connections, --conn-queue: bound the
+	                  TCP sessions served and waiting
+	                  --idle-timeout, --read-timeout, --write-timeout:
+	                  close silent or stuck clients (see tcpHandler.h)
+	<rate limits>     --udp-rate, --udp-burst, --udp-global-rate,
+	                  --udp-clients: drop UDP requests over quota
+	                  --udp-allow-stop: obey STOP over UDP even with
+	                  limits set (see rateLimit.h)
+	<roster options>  --disk, --cache-mb: pick the roster engine
+	                  --wal, --sync-us, --checkpoint-mb: log PUT/DEL
+	                  --find-limit: records per FIND reply, the rest
+	                  paged with AFTER (0: no FIND)
+	                  --name-index: build the FIND index (default off
+	                  with --disk, --huge-pages, --numa-replicate)
+	                  --student-index: build the WHERE index (default
+	                  off with --disk)
+	                  --huge-pages, --numa-replicate: serve a read-only
+	                  flat roster on huge pages, or one per NUMA node;
+	                  the indexes and the default (writable) roster stay
+	                  on normal pages (see roster.h)
+*/
+
+// SOCKET UTILITIES
+
+// Binds the TCP socket *tcpSoc and the UDP socket udpSoc to the same port,
+// in the range PORT_RANGE_LO - PORT_RANGE_HI (see mybind.c)
+// addr->sin_port must be 0; upon return it holds the port that was bound
+// *tcpSoc may be replaced, since a socket can't be bound twice
+// Returns 0 on success and -1 on error
+int bindPair(int * tcpSoc, int udpSoc, sockaddr_in * addr) {
+	for (unsigned int p = PORT_RANGE_LO; p <= PORT_RANGE_HI; p++) {
+		addr->sin_port = htons(p);
+		if (bind(*tcpSoc, (const sockaddr *) addr, sizeof(sockaddr_in)) < 0) {
+			continue;
+		}
+		if (bind(udpSoc, (const sockaddr *) addr, sizeof(sockaddr_in)) == 0) {
+			return 0;
+		}
+
+		// The UDP port is taken, start over with a fresh TCP socket
+		close(*tcpSoc);
+		*tcpSoc = socket(AF_INET, SOCK_STREAM, 0);
+		if (*tcpSoc < 0) {
+			return -1;
+		}
+	}
+
+	std::cerr << "bindPair(): no port available for both TCP and UDP" << std::endl;
+	return -1;
+}
+
+
+// MAIN
+
+int main(int argc, char * argv[]) {
+	std::string handoffPath;
+	std::string shmPath;
+	unsigned int traceEvery = 0;
+	RateLimitOptions rateLimitOptions;
+	ConnectionOptions connectionOptions;
+	RosterOptions rosterOptions;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--handoff" && i + 1 < argc) {
+			handoffPath = argv[++i];
+		} else if (arg == "--shm" && i + 1 < argc) {
+			shmPath = argv[++i];
+		} else if (arg == "--trace" && i + 1 < argc && isNumeric(argv[i + 1])) {
+			traceEvery = strtoul(argv[++i], NULL, 10);
+		} else if (!parseConnectionOption(argc, argv, i, connectionOptions) && !parseRateLimitOption(argc, argv, i, rateLimitOptions)
+			&& !parseRosterOption(argc, argv, i, rosterOptions)) {
+			std::cerr << "usage : " << argv[0] << " [--handoff <path>] [--shm <path>] [--trace <n>] " << CONNECTION_USAGE << " " << RATE_LIMIT_USAGE
+				<< " " << ROSTER_USAGE << std::endl;
+			return 1;
+		}
+	}
+
+	// The new server replays the WAL while the old one still logs writes,
+	// which it would never see
+	if (!handoffPath.empty() && !rosterOptions.walDir.empty()) {
+		std::cerr << "--handoff can't be used with --wal" << std::endl;
+		return 1;
+	}
+
+	// Before any thread starts, so that they all leave SIGUSR1 to the tracer
+	if (traceStart(traceEvery) < 0) {
+		return 1;
+	}
+
+	int tcpSoc, udpSoc;
+	sockaddr_in addr;
+
+	// Steps 1-4: Take over the previous server's sockets, or create new ones
+	std::vector<int> handedFds;
+	int peer = handoffPath.empty() ? -1 : takeover(handoffPath, handedFds, 2);
+	if (peer >= 0) {
+		if (handedFds.size() != 2 || socketType(handedFds[0]) != SOCK_STREAM || socketType(handedFds[1]) != SOCK_DGRAM) {
+			std::cerr << "Handoff: " << handoffPath << " is not serving TCP and UDP" << std::endl;
+			for (unsigned int i = 0; i < handedFds.size(); i++) close(handedFds[i]);
+			close(peer);
+			return 1;
+		}
+		tcpSoc = handedFds[0];
+		udpSoc = handedFds[1];
+		socklen_t addrLen = sizeof(sockaddr_in);
+		getsockname(tcpSoc, (sockaddr *) &addr, &addrLen);
+	} else {
+		// Step 1: Create sockets
+		tcpSoc = socket(AF_INET, SOCK_STREAM, 0);
+		udpSoc = socket(AF_INET, SOCK_DGRAM, 0);
+
+		if (tcpSoc < 0 || udpSoc < 0) {
+			perror("Socket:");
+			return 1;
+		}
+
+		// Step 2: Get the address for an appropriate network interface
+		if (getUnboundSockAddr(udpSoc, &addr) < 0) {
+			close(tcpSoc);
+			close(udpSoc);
+			return 1;
+		}
+		addr.sin_port = 0;
+
+		// Step 3: Bind both sockets to the same port
+		if (bindPair(&tcpSoc, udpSoc, &addr) < 0) {
+			perror("Bind:");
+			close(tcpSoc);
+			close(udpSoc);
+			return 1;
+		}
+
+		// Step 4: Open the TCP socket to listen for incoming requests
+		if (listen(tcpSoc, 1000) < 0) {
+			perror("Listen:");
+			close(tcpSoc);
+			close(udpSoc);
+			return 1;
+		}
+	}
+
+	// The sockets may be shared with another server during a handoff,
+	// so accept() must not block when the other one wins the connection
+	fcntl(tcpSoc, F_SETFL, fcntl(tcpSoc, F_GETFL) | O_NONBLOCK);
+
+	std::cout << inet_ntoa(addr.sin_addr) << " " << ntohs(addr.sin_port) << std::endl;
+
+	// Step 5: Construct the roster shared by both protocols
+	Roster * roster = loadRoster(std::cin, rosterOptions);
+	if (roster == NULL) {
+		close(tcpSoc);
+		close(udpSoc);
+		if (peer >= 0) close(peer);
+		return 1;
+	}
+
+	// UDP requests are served on this thread
+	bindToLocalNode();
+	EndSession endSession;
+	TcpAcceptor acceptor(tcpSoc, roster, &endSession, connectionOptions);
+	UdpHandler udpHandler(udpSoc, roster, rateLimitOptions);
+	int retCode = 0;
+
+	// Let the previous server go, and wait for our own successor
+	if (peer >= 0) {
+		handoffReady(peer);
+	}
+	std::vector<int> sockets;
+	sockets.push_back(tcpSoc);
+	sockets.push_back(udpSoc);
+	HandoffListener handoff(handoffPath, sockets);
+	if (!handoffPath.empty()) {
+		handoff.listen();
+	}
+	ShmListener shm(shmPath, roster, &endSession, connectionOptions);
+	if (!shmPath.empty()) {
+		shm.listen();
+	}
+	bool handedOff = false;
+
+	while (1) {
+		// Step 6: Check whether STOP has been sent on either protocol
+		if (endSession.isSet()) {
+			break;
+		}
+
+		// Step 7: Wait for TCP connections or UDP requests
+		// (TCP clients are served on their own threads,
+		// UDP requests are served from this loop)
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(tcpSoc, &fds);
+		FD_SET(udpSoc, &fds);
+		int maxFd = shm.fill(&fds, handoff.fill(&fds, tcpSoc > udpSoc ? tcpSoc : udpSoc));
+		timeval tv = {SELECT_WAIT_SECS, SELECT_WAIT_MICROSECS};
+
+		int retval = select(maxFd + 1, &fds, NULL, NULL, &tv);
+		if (retval < 0) {
+			perror("Select:");
+			retCode = 1;
+			break;
+		} else if (retval == 0) {
+			continue;
+		}
+
+		// Step 8: Serve whichever sockets are ready
+		if (FD_ISSET(udpSoc, &fds)) {
+			int handled = udpHandler.handle();
+			if (handled > 0) {
+				// STOP over UDP also stops the TCP client threads
+				endSession.set();
+			} else if (handled < 0) {
+				retCode = 1;
+				break;
+			}
+		}
+		if (FD_ISSET(tcpSoc, &fds) && acceptor.acceptClient() < 0) {
+			retCode = 1;
+			break;
+		}
+
+		shm.handle(&fds);
+
+		// A new server has taken over: stop accepting, drain our TCP clients
+		if (handoff.handle(&fds)) {
+			handedOff = true;
+			break;
+		}
+	}
+
+	// Step 9: Cleanup, join all client threads
+	if (!handedOff) {
+		endSession.set();
+	}
+	close(tcpSoc);
+	close(udpSoc);
+	acceptor.join();
+	shm.join();
+	if (shm.rejected || shm.expired || shm.corrupted) {
+		std::cerr << "Shared memory: rejected " << shm.rejected << " expired " << shm.expired
+			<< " corrupted " << shm.corrupted << std::endl;
+	}
+	if (acceptor.rejected || acceptor.expired) {
+		std::cerr << "TCP: accepted " << acceptor.accepted << " rejected " << acceptor.rejected
+			<< " expired " << acceptor.expired << std::endl;
+	}
+	if (rateLimitOptions.clientRate || rateLimitOptions.globalRate) {
+		std::cerr << "UDP: " << udpHandler.stats() << std::endl;
+	}
+	delete roster;
+	return retCode;
+}
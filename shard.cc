@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <stdio.h>
+#include "shard.h"
+
+// SHARD RING
+
+uint64_t hash64(const std::string & key) {
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < key.length(); i++) {
+		h ^= (unsigned char) key[i];
+		h *= 1099511628211ull;
+	}
+	// FNV alone clusters similar keys (such as numeric IDs); mix the bits
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+ShardRing::ShardRing(unsigned int shards) {
+	for (unsigned int s = 0; s < shards; s++) {
+		for (unsigned int v = 0; v < VNODES_PER_SHARD; v++) {
+			char name[64];
+			snprintf(name, sizeof(name), "shard-%u-%u", s, v);
+			points.push_back(std::make_pair(hash64(name), s));
+		}
+	}
+	std::sort(points.begin(), points.end());
+}
+
+unsigned int ShardRing::shardFor(const std::string & groupId) const {
+	if (points.empty()) {
+		return 0;
+	}
+	// The first point clockwise from the key's hash, wrapping around
+	std::vector<std::pair<uint64_t, unsigned int> >::const_iterator it =
+		std::lower_bound(points.begin(), points.end(), std::make_pair(hash64(groupId), 0u));
+	if (it == points.end()) {
+		it = points.begin();
+	}
+	return it->second;
+}
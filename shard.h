@@ -0,0 +1,31 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// SHARD RING
+// Consistent hashing of group IDs onto shards 0..N-1. Every shard owns
+// VNODES_PER_SHARD points on a 64-bit ring, placed by hashing the shard's
+// index (not its address), so the clients and splitRoster agree on the
+// layout. Adding shard N only takes over the keys that fall on its own
+// points: about 1/(N+1) of them move, all to the new shard
+
+#define VNODES_PER_SHARD 160
+
+// Stable 64-bit hash (FNV-1a with a final avalanche), the same on every build
+uint64_t hash64(const std::string & key);
+
+class ShardRing {
+	std::vector<std::pair<uint64_t, unsigned int> > points;	// sorted by hash
+
+public:
+	ShardRing(unsigned int shards);
+
+	// The shard responsible for groupId
+	unsigned int shardFor(const std::string & groupId) const;
+};
+
+#endif
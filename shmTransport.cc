@@ -0,0 +1,411 @@
+#include <errno.h>
+#include <iostream>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "handoff.h"
+#include "shmTransport.h"
+#include "timerWheel.h"
+
+// Marks the end of the data before the ring wraps around
+#define SHM_WRAP 0xffffffffu
+
+// Spin budgets of a consumer (iterations of a pause)
+#define SHM_MAX_SPIN 4096
+#define SHM_MIN_SPIN 16
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+	"the rings need address-free atomics to be shared between processes");
+
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static inline size_t recordBytes(size_t length) {
+	return (4 + length + 7) & ~(size_t) 7;
+}
+
+// Shared (not FUTEX_PRIVATE): the two sides are different processes
+static void futexWait(std::atomic<uint32_t> * word, uint32_t value, int timeoutMs) {
+	timespec ts = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000L};
+	syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+static void futexWake(std::atomic<uint32_t> * word) {
+	syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Whether the other end of the Unix socket has closed it
+static bool peerClosed(int sockfd) {
+	char c;
+	int l = recv(sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	return l == 0 || (l < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+
+// SHM CHANNEL
+
+ShmChannel::ShmChannel(ShmRing * in, ShmRing * out): in(in), out(out) {
+	maxSpin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_MAX_SPIN : 0;
+	spin = maxSpin / 4;
+}
+
+bool ShmChannel::send(const std::string & msg) {
+	size_t need = recordBytes(msg.length());
+	if (need > SHM_RING_BYTES / 2) {
+		return false;
+	}
+
+	// Step 1: Find room, at the end of the ring or, if the record doesn't
+	// fit there, at its start
+	uint64_t tail = out->tail.load(std::memory_order_relaxed);
+	uint64_t head = out->head.load(std::memory_order_acquire);
+	size_t pos = tail % SHM_RING_BYTES;
+	size_t skip = SHM_RING_BYTES - pos < need ? SHM_RING_BYTES - pos : 0;
+	if (tail + skip + need - head > SHM_RING_BYTES) {
+		return false;
+	}
+	if (skip) {
+		*(uint32_t *) (out->data + pos) = SHM_WRAP;
+		tail += skip;
+		pos = 0;
+	}
+
+	// Step 2: Write the record, then publish it
+	*(uint32_t *) (out->data + pos) = msg.length();
+	memcpy(out->data + pos + 4, msg.data(), msg.length());
+	out->tail.store(tail + need);
+	out->seq.fetch_add(1);
+
+	// Step 3: Wake the consumer if it went to sleep (seq_cst: either it
+	// sees the new tail before sleeping, or we see it asleep)
+	if (out->sleeping.load()) {
+		futexWake(&out->seq);
+	}
+	return true;
+}
+
+// Takes the next message off ring, if there is one
+// Returns 1 if msg was set, 0 if the ring is empty and -1 if the other side
+// wrote a record that doesn't fit the ring (nothing is read past its end)
+static int take(ShmRing * ring, std::string & msg) {
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	uint64_t tail = ring->tail.load(std::memory_order_acquire);
+	if (tail == head) {
+		return 0;
+	}
+	// Both words are in shared memory: check them before reading anything
+	if (tail - head > SHM_RING_BYTES || head % 8 != 0) {
+		return -1;
+	}
+	size_t pos = head % SHM_RING_BYTES;
+	uint32_t length = *(const volatile uint32_t *) (ring->data + pos);
+	if (length == SHM_WRAP) {
+		head += SHM_RING_BYTES - pos;
+		pos = 0;
+		if (tail - head > SHM_RING_BYTES) {
+			return -1;
+		}
+		length = *(const volatile uint32_t *) ring->data;
+	}
+	if (length > SHM_RING_BYTES - 4 || pos + 4 + length > SHM_RING_BYTES || head + recordBytes(length) > tail) {
+		return -1;
+	}
+	msg.assign(ring->data + pos + 4, length);
+	ring->head.store(head + recordBytes(length), std::memory_order_release);
+	return 1;
+}
+
+int ShmChannel::receive(std::string & msg, int timeoutMs) {
+	// Step 1: Spin; a message that arrives while spinning earns a longer spin
+	for (unsigned int i = 0; i < spin; i++) {
+		int taken = take(in, msg);
+		if (taken) {
+			spin = spin + spin / 4 < maxSpin ? spin + spin / 4 : maxSpin;
+			return taken;
+		}
+		cpuRelax();
+	}
+	int taken = take(in, msg);
+	if (taken) {
+		return taken;
+	}
+	if (maxSpin) {
+		spin = spin / 2 > SHM_MIN_SPIN ? spin / 2 : SHM_MIN_SPIN;
+	}
+
+	// Step 2: Sleep until the producer bumps seq (or the timeout)
+	in->sleeping.store(1);
+	uint32_t seq = in->seq.load();
+	taken = take(in, msg);
+	if (!taken) {
+		futexWait(&in->seq, seq, timeoutMs);
+		taken = take(in, msg);
+	}
+	in->sleeping.store(0);
+	return taken;
+}
+
+
+// SHM LISTENER
+
+ShmListener::~ShmListener() {
+	join();
+	if (listenSoc >= 0) {
+		close(listenSoc);
+		unlink(path.c_str());
+	}
+}
+
+int ShmListener::listen() {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.length() >= sizeof(addr.sun_path)) {
+		std::cerr << "Shared memory path too long: " << path << std::endl;
+		return -1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	listenSoc = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenSoc < 0) {
+		perror("Socket:");
+		return -1;
+	}
+	unlink(path.c_str());
+	if (bind(listenSoc, (const sockaddr *) &addr, sizeof(addr)) < 0 || ::listen(listenSoc, 64) < 0) {
+		perror("Shared memory listen:");
+		close(listenSoc);
+		listenSoc = -1;
+		return -1;
+	}
+	return 0;
+}
+
+int ShmListener::fill(fd_set * fdSet, int maxFd) const {
+	if (listenSoc < 0) {
+		return maxFd;
+	}
+	FD_SET(listenSoc, fdSet);
+	return listenSoc > maxFd ? listenSoc : maxFd;
+}
+
+void ShmListener::handle(const fd_set * fdSet) {
+	reap(false);
+	if (listenSoc < 0 || !FD_ISSET(listenSoc, fdSet)) {
+		return;
+	}
+	int sockfd = accept4(listenSoc, NULL, NULL, SOCK_CLOEXEC);
+	if (sockfd < 0) {
+		return;
+	}
+	if (sessions.size() >= options.maxConnections) {
+		rejected++;
+		send(sockfd, "ERROR_BUSY", sizeof("ERROR_BUSY"), MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(sockfd);
+		return;
+	}
+
+	// Step 1: Create and map the region
+	int memfd = memfd_create("roster-shm", MFD_CLOEXEC);
+	if (memfd < 0 || ftruncate(memfd, sizeof(ShmRegion)) < 0) {
+		perror("memfd:");
+		if (memfd >= 0) close(memfd);
+		close(sockfd);
+		return;
+	}
+	void * mem = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap:");
+		close(memfd);
+		close(sockfd);
+		return;
+	}
+
+	// Step 2: Initialise it (the pages are zero, so are the rings), then
+	// hand it to the client
+	ShmRegion * region = (ShmRegion *) mem;
+	region->magic = SHM_MAGIC;
+	region->ringBytes = SHM_RING_BYTES;
+	int sent = sendFds(sockfd, std::vector<int>(1, memfd));
+	close(memfd);
+	if (sent < 0) {
+		munmap(mem, sizeof(ShmRegion));
+		close(sockfd);
+		return;
+	}
+
+	// Step 3: Serve it on its own thread
+	Session * session = new Session;
+	session->sockfd = sockfd;
+	session->region = region;
+	session->owner = this;
+	session->done.store(false);
+	if (pthread_create(&session->id, NULL, serve, session) != 0) {
+		munmap(mem, sizeof(ShmRegion));
+		close(sockfd);
+		delete session;
+		return;
+	}
+	sessions.push_back(session);
+}
+
+void * ShmListener::serve(void * arg) {
+	Session * session = (Session *) arg;
+	ShmListener * owner = session->owner;
+	EndSession * endSession = owner->endSession;
+	bindToLocalNode();
+	ShmChannel channel(&session->region->requests, &session->region->replies);
+	uint64_t lastActivity = monotonicMillis();
+
+	std::string msg;
+	bool end = false;
+	while (!end && !endSession->isSet()) {
+		int received = channel.receive(msg, SELECT_WAIT_SECS * 1000 + SELECT_WAIT_MICROSECS / 1000);
+		if (received < 0) {
+			owner->corrupted++;
+			break;
+		}
+		if (received == 0) {
+			uint64_t deadline = owner->options.deadline(lastActivity, 0);
+			if (deadline && monotonicMillis() >= deadline) {
+				owner->expired++;
+				break;
+			}
+			end = peerClosed(session->sockfd);
+			continue;
+		}
+		lastActivity = monotonicMillis();
+
+		InputBuffer inputBuffer(msg);
+		while (!end && inputBuffer.next()) {
+			// STOP case (stop() == true implies stopSession() == true)
+			if (inputBuffer.stop()) {
+				endSession->set();
+			}
+			if (inputBuffer.stopSession()) {
+				end = true;
+				break;
+			}
+
+			// The client reads every reply before its next request, so
+			// the ring only fills up if the client is gone or stuck
+			std::string reply;
+			uint64_t blockedSince = 0;
+			if (execute(inputBuffer, owner->roster, reply)) {
+				while (!end && !channel.send(reply) && !endSession->isSet()) {
+					blockedSince = blockedSince ? blockedSince : monotonicMillis();
+					uint64_t deadline = owner->options.deadline(lastActivity, 0, blockedSince);
+					if (deadline && monotonicMillis() >= deadline) {
+						owner->expired++;
+						end = true;
+					} else if (peerClosed(session->sockfd)) {
+						end = true;
+					}
+					sched_yield();
+				}
+			}
+		}
+	}
+
+	munmap(session->region, sizeof(ShmRegion));
+	close(session->sockfd);
+	session->done.store(true);
+	return NULL;
+}
+
+void ShmListener::reap(bool all) {
+	for (size_t i = 0; i < sessions.size(); ) {
+		if (all || sessions[i]->done.load()) {
+			pthread_join(sessions[i]->id, NULL);
+			delete sessions[i];
+			sessions[i] = sessions.back();
+			sessions.pop_back();
+		} else {
+			i++;
+		}
+	}
+}
+
+void ShmListener::join() {
+	reap(true);
+}
+
+
+// SHM CLIENT
+
+ShmClient::~ShmClient() {
+	delete channel;
+	if (region != NULL) {
+		munmap(region, sizeof(ShmRegion));
+	}
+	if (sockfd >= 0) {
+		close(sockfd);
+	}
+}
+
+int ShmClient::connect(const std::string & path) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.length() >= sizeof(addr.sun_path)) {
+		std::cerr << "Shared memory path too long: " << path << std::endl;
+		return -1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	// Step 1: Connect, and receive the region
+	sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sockfd < 0 || ::connect(sockfd, (const sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("Shared memory connect:");
+		return -1;
+	}
+	std::vector<int> fds;
+	if (recvFds(sockfd, fds, 1) < 0 || fds.size() != 1) {
+		std::cerr << "Shared memory: no region from the server (busy, or not serving)" << std::endl;
+		return -1;
+	}
+
+	// Step 2: Map it
+	void * mem = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	close(fds[0]);
+	if (mem == MAP_FAILED) {
+		perror("mmap:");
+		return -1;
+	}
+	region = (ShmRegion *) mem;
+	if (region->magic != SHM_MAGIC || region->ringBytes != SHM_RING_BYTES) {
+		std::cerr << "Shared memory: the server speaks another version" << std::endl;
+		return -1;
+	}
+	channel = new ShmChannel(&region->replies, &region->requests);
+	return 0;
+}
+
+int ShmClient::request(const std::string & command, std::string & reply) {
+	if (channel == NULL || !channel->send(command)) {
+		return -1;
+	}
+
+	// STOP and STOP_SESSION get no reply
+	InputBuffer inputBuffer(command);
+	if (inputBuffer.next() && inputBuffer.stopSession()) {
+		return 0;
+	}
+	int received;
+	while ((received = channel->receive(reply, SELECT_WAIT_SECS * 1000 + SELECT_WAIT_MICROSECS / 1000)) == 0) {
+		if (peerClosed(sockfd)) {
+			return -1;
+		}
+	}
+	return received < 0 ? -1 : 0;
+}
@@ -0,0 +1,155 @@
+#ifndef SHM_TRANSPORT_H
+#define SHM_TRANSPORT_H
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <sys/select.h>
+#include <vector>
+#include "roster.h"
+#include "tcpHandler.h"
+
+// SHARED MEMORY TRANSPORT
+// For clients on the same host as the server: requests and replies go
+// through a pair of rings in shared memory rather than through a socket
+//
+// A client connects to the Unix socket given to the server with --shm, and
+// gets back a memfd (SCM_RIGHTS, see handoff.h) holding one ShmRegion,
+// which both sides map. The socket stays open for the session: closing it
+// on either side ends the session. Every message in a ring is one command
+// (as sent over TCP, without the terminator) or one reply. Commands mean
+// what they mean over TCP: STOP_SESSION ends the session, STOP the server
+//
+// Each ring has a single producer and a single consumer, and is lock-free:
+// the producer owns tail, the consumer owns head. A consumer with nothing
+// to read spins for a while, then sleeps on a futex in the region, which
+// the producer only wakes if the consumer said it is asleep. The spin
+// adapts: it grows while messages keep arriving during it, and shrinks
+// when they don't (it is 0 on a single CPU, where spinning only delays
+// the other side)
+
+#define SHM_RING_BYTES (1 << 20)
+#define SHM_MAGIC 0x52534d31			// "RSM1"
+
+struct ShmRing {
+	alignas(64) std::atomic<uint64_t> head;		// bytes consumed
+	alignas(64) std::atomic<uint64_t> tail;		// bytes produced
+	std::atomic<uint32_t> seq;					// futex word, bumped on every message
+	alignas(64) std::atomic<uint32_t> sleeping;	// the consumer is waiting on seq
+	alignas(64) char data[SHM_RING_BYTES];
+};
+
+struct ShmRegion {
+	uint32_t magic;
+	uint32_t ringBytes;
+	ShmRing requests;					// client -> server
+	ShmRing replies;					// server -> client
+};
+
+// One side of a mapped region
+class ShmChannel {
+	ShmRing * in;
+	ShmRing * out;
+	unsigned int spin;					// current spin budget (iterations)
+	unsigned int maxSpin;
+
+public:
+	ShmChannel(ShmRing * in, ShmRing * out);
+
+	// Queues msg for the other side
+	// Returns false if the ring has no room for it right now
+	bool send(const std::string & msg);
+
+	// Takes the next message, waiting up to timeoutMs for one
+	// Returns 1 if msg was set, 0 on timeout and -1 if the other side
+	// corrupted the ring (the session must end)
+	int receive(std::string & msg, int timeoutMs);
+};
+
+
+// SERVER SIDE
+// Listens on the Unix socket and serves each client on its own thread
+// (the rings are polled by that thread, not by the select() loop)
+//
+// The connection options of the TCP server apply: at most maxConnections
+// sessions at once (clients past that are sent ERROR_BUSY and no region),
+// idleTimeoutMs closes sessions that send nothing for that long, and the
+// write timeout those that don't take their replies. There are no partial
+// requests, so readTimeoutMs doesn't apply. A client that writes a record
+// the ring can't hold loses its session
+
+class ShmListener {
+	struct Session {
+		pthread_t id;
+		int sockfd;						// Unix socket, open for the session
+		ShmRegion * region;
+		ShmListener * owner;
+		std::atomic<bool> done;
+	};
+
+	std::string path;
+	Roster * roster;
+	EndSession * endSession;
+	ConnectionOptions options;
+	int listenSoc;
+	std::vector<Session *> sessions;
+
+	static void * serve(void * arg);
+	void reap(bool all);
+
+public:
+	uint64_t rejected;
+	std::atomic<uint64_t> expired;		// closed by the idle timeout
+	std::atomic<uint64_t> corrupted;	// closed for a bad ring
+
+	ShmListener(const std::string & path, Roster * roster, EndSession * endSession, const ConnectionOptions & options):
+		path(path),
+		roster(roster),
+		endSession(endSession),
+		options(options),
+		listenSoc(-1),
+		rejected(0),
+		expired(0),
+		corrupted(0)
+	{}
+	~ShmListener();
+
+	// Start listening on path, replacing any stale socket there
+	// Returns 0 on success and -1 on error
+	int listen();
+
+	// Add the listening socket to fdSet, returns the highest descriptor
+	int fill(fd_set * fdSet, int maxFd) const;
+
+	// Accept the client select() reported in fdSet, if any, and free the
+	// sessions that have ended
+	void handle(const fd_set * fdSet);
+
+	// Wait for every session to end (call once STOP has been sent)
+	void join();
+};
+
+
+// CLIENT SIDE
+// Synchronous: one request at a time
+
+class ShmClient {
+	int sockfd;
+	ShmRegion * region;
+	ShmChannel * channel;
+
+public:
+	ShmClient(): sockfd(-1), region(NULL), channel(NULL) {}
+	~ShmClient();
+
+	// Connects to the server listening on path and maps its region
+	// Returns 0 on success and -1 on error
+	int connect(const std::string & path);
+
+	// Sends command and, unless it is STOP or STOP_SESSION, waits for the reply
+	// Returns 0 on success and -1 if the server went away
+	int request(const std::string & command, std::string & reply);
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+#include "common.h"
+#include "shard.h"
+
+/*
+	Splits a roster (read from stdin) into per-shard rosters for
+	sharded servers, using the same ring as the clients.
+
+	Usage: splitRoster <shards> <prefix>
+
+	Writes <prefix>.0 ... <prefix>.<shards - 1>; shard i's file is the
+	roster for the server given as the i-th endpoint to the clients.
+*/
+
+int main(int argc, char * argv[]) {
+	if (argc < 3 || !isNumeric(argv[1]) || atoi(argv[1]) < 1) {
+		std::cerr << "usage : " << argv[0] << " <shards> <prefix>" << std::endl;
+		return 1;
+	}
+	unsigned int shards = atoi(argv[1]);
+	std::string prefix = argv[2];
+
+	// Step 1: Open one output roster per shard
+	std::vector<std::ofstream *> outs;
+	std::vector<std::string> lastGroup(shards);
+	std::vector<bool> started(shards, false);
+	std::vector<size_t> counts(shards, 0);
+	for (unsigned int i = 0; i < shards; i++) {
+		std::string path = prefix + "." + std::to_string(i);
+		outs.push_back(new std::ofstream(path.c_str()));
+		if (!*outs.back()) {
+			std::cerr << "Could not open " << path << std::endl;
+			return 1;
+		}
+	}
+
+	// Step 2: Route every student record by its group ID, repeating the
+	// group declaration in a shard's file whenever its group changes
+	ShardRing ring(shards);
+	RosterReader reader(std::cin);
+	std::string groupId, studentId, studentName;
+	while (reader.next(groupId, studentId, studentName)) {
+		unsigned int s = ring.shardFor(groupId);
+		if (!started[s] || lastGroup[s] != groupId) {
+			*outs[s] << "group " << groupId << "\n";
+			lastGroup[s] = groupId;
+			started[s] = true;
+		}
+		*outs[s] << studentId << " " << studentName << "\n";
+		counts[s]++;
+	}
+
+	// Step 3: Report the split
+	int retCode = 0;
+	for (unsigned int i = 0; i < shards; i++) {
+		outs[i]->close();
+		if (outs[i]->fail()) retCode = 1;
+		delete outs[i];
+		std::cerr << prefix << "." << i << ": " << counts[i] << " students" << std::endl;
+	}
+	return retCode;
+}
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <string.h>
+#include "studentIndex.h"
+
+// ID ORDER
+// Shorter first, then by character: numeric IDs sort by value
+
+static inline bool idLess(const char * a, size_t aLength, const char * b, size_t bLength) {
+	return aLength != bLength ? aLength < bLength : memcmp(a, b, aLength) < 0;
+}
+
+struct IdOrder {
+	const char * arena;
+	bool operator()(uint32_t a, uint32_t b) const {
+		return idLess(arena + a, strlen(arena + a), arena + b, strlen(arena + b));
+	}
+};
+
+struct IdBefore {
+	const char * arena;
+	bool operator()(uint32_t a, const std::string & id) const {
+		return idLess(arena + a, strlen(arena + a), id.c_str(), id.length());
+	}
+};
+
+// STUDENT INDEX
+
+StudentIndex::StudentIndex() {
+	pthread_mutex_init(&m, NULL);
+}
+
+StudentIndex::~StudentIndex() {
+	pthread_mutex_destroy(&m);
+}
+
+uint32_t StudentIndex::intern(const std::string & id) {
+	std::unordered_map<std::string, uint32_t>::iterator it = ids.find(id);
+	if (it != ids.end()) {
+		return it->second;
+	}
+	uint32_t offset = arena.length();
+	arena.append(id.c_str(), id.length() + 1);
+	ids[id] = offset;
+	return offset;
+}
+
+void StudentIndex::add(const std::string & groupId, const std::string & studentId) {
+	pairs.push_back(std::make_pair(intern(studentId), intern(groupId)));
+}
+
+void StudentIndex::finish() {
+	// Step 1: Sort the distinct IDs, separately for students and groups (an
+	// ID can be both), and number them in that order
+	std::unordered_map<uint32_t, uint32_t> studentRank, groupRank;
+	for (size_t i = 0; i < pairs.size(); i++) {
+		if (studentRank.insert(std::make_pair(pairs[i].first, 0)).second) {
+			students.push_back(pairs[i].first);
+		}
+		if (groupRank.insert(std::make_pair(pairs[i].second, 0)).second) {
+			groups.push_back(pairs[i].second);
+		}
+	}
+	IdOrder order = {arena.data()};
+	std::sort(students.begin(), students.end(), order);
+	std::sort(groups.begin(), groups.end(), order);
+	for (size_t i = 0; i < students.size(); i++) {
+		studentRank[students[i]] = i;
+	}
+	for (size_t i = 0; i < groups.size(); i++) {
+		groupRank[groups[i]] = i;
+	}
+
+	// Step 2: Count the groups of every student, then lay out the postings
+	std::vector<uint32_t> rows(pairs.size());
+	starts.assign(students.size() + 1, 0);
+	for (size_t i = 0; i < pairs.size(); i++) {
+		rows[i] = studentRank[pairs[i].first];
+		starts[rows[i] + 1]++;
+	}
+	for (size_t i = 0; i < students.size(); i++) {
+		starts[i + 1] += starts[i];
+	}
+	std::vector<uint32_t> next(starts.begin(), starts.end() - 1);
+	postings.resize(pairs.size());
+	for (size_t i = 0; i < pairs.size(); i++) {
+		postings[next[rows[i]]++] = groupRank[pairs[i].second];
+	}
+	for (size_t i = 0; i < students.size(); i++) {
+		std::sort(postings.begin() + starts[i], postings.begin() + starts[i + 1]);
+	}
+
+	// Step 3: Drop what only the build needed
+	std::unordered_map<std::string, uint32_t>().swap(ids);
+	std::vector<std::pair<uint32_t, uint32_t> >().swap(pairs);
+	arena.shrink_to_fit();
+}
+
+void StudentIndex::insert(const std::string & groupId, const std::string & studentId) {
+	std::string key = studentId;
+	key += '\0';
+	key += groupId;
+
+	pthread_mutex_lock(&m);
+	added.insert(key);
+	pthread_mutex_unlock(&m);
+}
+
+void StudentIndex::remove(const std::string & groupId, const std::string & studentId) {
+	std::string key = studentId;
+	key += '\0';
+	key += groupId;
+
+	pthread_mutex_lock(&m);
+	added.erase(key);
+	pthread_mutex_unlock(&m);
+}
+
+void StudentIndex::search(const std::string & studentId, GroupVisitor visit, void * arg) const {
+	// The groups PUT since startup (few), in group order
+	std::vector<std::string> put;
+	std::string prefix = studentId;
+	prefix += '\0';
+	pthread_mutex_lock(&m);
+	std::set<std::string>::const_iterator a = added.lower_bound(prefix);
+	for (; a != added.end() && a->compare(0, prefix.length(), prefix) == 0; ++a) {
+		put.push_back(a->substr(prefix.length()));
+	}
+	pthread_mutex_unlock(&m);
+	struct GroupOrder {
+		bool operator()(const std::string & a, const std::string & b) const {
+			return idLess(a.c_str(), a.length(), b.c_str(), b.length());
+		}
+	};
+	std::sort(put.begin(), put.end(), GroupOrder());
+
+	// The postings of studentId, if it was indexed
+	uint32_t p = 0, end = 0;
+	IdBefore before = {arena.data()};
+	std::vector<uint32_t>::const_iterator student = std::lower_bound(students.begin(), students.end(), studentId, before);
+	if (student != students.end() && studentId == arena.data() + *student) {
+		p = starts[student - students.begin()];
+		end = starts[student - students.begin() + 1];
+	}
+
+	// Merge the two; a group in both is visited once
+	size_t i = 0;
+	while (p < end || i < put.size()) {
+		const char * indexed = p < end ? arena.data() + groups[postings[p]] : NULL;
+		int c = !indexed ? 1 : i == put.size() ? -1
+			: idLess(indexed, strlen(indexed), put[i].c_str(), put[i].length()) ? -1
+			: put[i] == indexed ? 0 : 1;
+		std::string groupId = c <= 0 ? std::string(indexed) : put[i];
+		if (c <= 0) p++;
+		if (c >= 0) i++;
+		if (!visit(arg, groupId)) {
+			return;
+		}
+	}
+}
+
+size_t StudentIndex::memoryBytes() const {
+	return arena.capacity() + (students.capacity() + starts.capacity() + postings.capacity() + groups.capacity()) * sizeof(uint32_t);
+}
@@ -0,0 +1,78 @@
+#ifndef STUDENT_INDEX_H
+#define STUDENT_INDEX_H
+
+#include <pthread.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// STUDENT INDEX
+// Serves WHERE: the groups a student ID is in, without a scan of every group
+//
+// Built once at startup, in the same Roster::scan() as the name index. Every
+// distinct group and student ID is stored once, NUL-terminated, in an arena;
+// the postings are laid out like a compressed sparse row matrix:
+//
+//   students[i]                       arena offset of the i-th student ID
+//   postings[starts[i] .. starts[i+1]) its groups, as positions in groups
+//   groups[j]                         arena offset of the j-th group ID
+//
+// students and groups are sorted (numerically for numeric IDs), and so is
+// each postings list. A (group, student) pair costs 4 bytes, a distinct
+// student 8 bytes plus its ID: no per-entry heap nodes. A lookup is one
+// binary search over students
+//
+// Pairs PUT since startup go to a sorted set beside the arrays, and leave it
+// when deleted; as with the name index, the roster is the judge of which
+// candidates still exist
+
+// Receives the candidates of StudentIndex::search(). Returns false to end
+// the search
+typedef bool (*GroupVisitor)(void * arg, const std::string & groupId);
+
+class StudentIndex {
+	std::string arena;
+	std::vector<uint32_t> students;
+	std::vector<uint32_t> starts;
+	std::vector<uint32_t> postings;
+	std::vector<uint32_t> groups;
+
+	mutable pthread_mutex_t m;
+	std::set<std::string> added;		// "<student>\0<group>"
+
+	// While building: the arena offset of every distinct ID, and every
+	// (student, group) pair as offsets
+	std::unordered_map<std::string, uint32_t> ids;
+	std::vector<std::pair<uint32_t, uint32_t> > pairs;
+
+	uint32_t intern(const std::string & id);
+
+public:
+	StudentIndex();
+	~StudentIndex();
+
+	// Building: add() every record, then finish()
+	void add(const std::string & groupId, const std::string & studentId);
+	void finish();
+
+	// Indexes a pair PUT while serving
+	void insert(const std::string & groupId, const std::string & studentId);
+
+	// Forgets a pair insert()ed, once it is deleted
+	void remove(const std::string & groupId, const std::string & studentId);
+
+	// Visits the candidate groups of studentId in group order
+	void search(const std::string & studentId, GroupVisitor visit, void * arg) const;
+
+	size_t size() const {
+		return students.size();
+	}
+	size_t groupCount() const {
+		return groups.size();
+	}
+	size_t memoryBytes() const;
+};
+
+#endif
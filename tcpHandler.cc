@@ -0,0 +1,304 @@
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "tcpHandler.h"
+#include "timerWheel.h"
+#include "trace.h"
+
+// Session buffers grown past this are released when the session is recycled
+#define SESSION_BUFFER_KEEP 65536
+
+// CONNECTION OPTIONS
+
+bool parseConnectionOption(int argc, char * argv[], int & i, ConnectionOptions & options) {
+	std::string arg = argv[i];
+	if (i + 1 >= argc || !isNumeric(argv[i + 1])) {
+		return false;
+	}
+	unsigned long value = strtoul(argv[i + 1], NULL, 10);
+	if (arg == "--max-connections" && value > 0) {
+		options.maxConnections = value;
+	} else if (arg == "--conn-queue") {
+		options.queueLength = value;
+	} else if (arg == "--idle-timeout") {
+		options.idleTimeoutMs = value;
+	} else if (arg == "--read-timeout") {
+		options.readTimeoutMs = value;
+	} else if (arg == "--write-timeout") {
+		options.writeTimeoutMs = value;
+	} else {
+		return false;
+	}
+	i++;
+	return true;
+}
+
+const char * CONNECTION_USAGE = "[--max-connections <n>] [--conn-queue <n>] [--idle-timeout <ms>] [--read-timeout <ms>] [--write-timeout <ms>]";
+
+
+// CLIENT SESSION
+
+// Writes all of data to the (blocking) socket, giving up if the client
+// takes none of it for timeoutMs (0: no limit)
+// Returns 0 on success, -1 on error and -2 on timeout
+static int writeAll(int sockfd, const std::string & data, uint64_t timeoutMs) {
+	for (size_t off = 0; off < data.length(); ) {
+		if (timeoutMs) {
+			pollfd pfd = {sockfd, POLLOUT, 0};
+			int ready = poll(&pfd, 1, timeoutMs);
+			if (ready < 0 && errno == EINTR) continue;
+			if (ready < 0) return -1;
+			if (ready == 0) return -2;
+		}
+		int l = send(sockfd, data.data() + off, data.length() - off, MSG_NOSIGNAL | (timeoutMs ? MSG_DONTWAIT : 0));
+		if (l < 0) {
+			if (errno == EINTR || (timeoutMs && (errno == EAGAIN || errno == EWOULDBLOCK))) continue;
+			return -1;
+		}
+		off += l;
+	}
+	return 0;
+}
+
+// Serves one client until it leaves (or STOP)
+// Returns true if the client was dropped for a timeout
+static bool serve(ClientSession * session, const ConnectionOptions & options, TraceBatch & trace) {
+	char buf[4096];
+	std::string & in = session->in;
+	uint64_t lastActivity = monotonicMillis(), partialSince = 0;
+
+	while (1) {
+		// Check whether the STOP signal has been sent
+		if (session->endSession->isSet()) {
+			return false;
+		}
+
+		// This worker serves this connection alone, so its deadline is
+		// the select() timeout when that comes before the next STOP check
+		uint64_t deadline = options.deadline(lastActivity, partialSince);
+		uint64_t now = monotonicMillis();
+		if (deadline && now >= deadline) {
+			return true;
+		}
+
+		// Use select() here in order to regularly check whether STOP has been sent
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(session->sockfd, &fds);
+		timeval tv = {SELECT_WAIT_SECS, SELECT_WAIT_MICROSECS};
+		if (deadline && deadline - now < (uint64_t) SELECT_WAIT_SECS * 1000 + SELECT_WAIT_MICROSECS / 1000) {
+			tv.tv_sec = (deadline - now) / 1000;
+			tv.tv_usec = (deadline - now) % 1000 * 1000;
+		}
+
+		int retval = select(session->sockfd + 1, &fds, NULL, NULL, &tv);
+		if (retval < 0) {
+			// Error
+			perror("Select:");
+			return false;
+		} else if (retval == 0) {
+			// Nothing to be read from socket
+			continue;
+		}
+		trace.woke();
+
+		// Read from client socket
+		uint64_t arrival = 0;
+		int l = trace.enabled()
+			? traceRead(session->sockfd, buf, sizeof(buf), &arrival)
+			: read(session->sockfd, buf, sizeof(buf));
+		if (l <= 0) {
+			// Client closed the connection (or it failed)
+			return false;
+		}
+		in.append(buf, l);
+		trace.received(arrival);
+		lastActivity = monotonicMillis();
+
+		// Commands are terminated by a newline or by the NUL the clients
+		// send; a client may pipeline several, and the last may be partial
+		std::string & out = session->out;
+		out.clear();
+		bool end = false;
+		size_t start = 0;
+		while (!end) {
+			size_t stop = in.find_first_of(std::string("\n\0", 2), start);
+			if (stop == std::string::npos) break;
+
+			trace.start();
+			InputBuffer inputBuffer(in.substr(start, stop - start));
+			start = stop + 1;
+			if (!inputBuffer.next()) continue;
+			trace.parsed(inputBuffer);
+
+			// STOP case (stop() == true implies stopSession() == true)
+			if (inputBuffer.stop()) {
+				// Communicate to other threads that STOP has been sent
+				session->endSession->set();
+			}
+			if (inputBuffer.stopSession()) {
+				end = true;
+				break;
+			}
+
+			// GET and error cases; every reply ends with a NUL
+			std::string reply;
+			if (execute(inputBuffer, session->roster, reply)) {
+				out += reply;
+				out += '\0';
+			}
+			trace.executed();
+		}
+		in.erase(0, start);
+		partialSince = in.empty() ? 0 : partialSince ? partialSince : lastActivity;
+		if (in.length() > MAX_REQUEST_BYTES) {
+			out += std::string(REQUEST_TOO_LONG, sizeof(REQUEST_TOO_LONG));
+			end = true;
+		}
+
+		// All the replies to one read go out in one write
+		int written = writeAll(session->sockfd, out, options.writeLimit());
+		if (written < 0 || end) {
+			return written == -2;
+		}
+		trace.written();
+	}
+}
+
+
+// TCP ACCEPTOR
+
+TcpAcceptor::TcpAcceptor(int soc, Roster * roster, EndSession * endSession, const ConnectionOptions & options):
+	soc(soc),
+	roster(roster),
+	endSession(endSession),
+	options(options),
+	idle(0),
+	stopping(false),
+	accepted(0),
+	rejected(0),
+	expired(0)
+{
+	pthread_mutex_init(&m, NULL);
+	pthread_cond_init(&ready, NULL);
+}
+
+TcpAcceptor::~TcpAcceptor() {
+	join();
+	for (unsigned int i = 0; i < pool.size(); i++) {
+		delete pool[i];
+	}
+	pthread_cond_destroy(&ready);
+	pthread_mutex_destroy(&m);
+}
+
+int TcpAcceptor::acceptClient(int listener) {
+	int clientSoc = accept(listener, NULL, NULL);
+	if (clientSoc < 0) {
+		// Another process sharing the socket (see handoff.h) took the connection
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return 0;
+		}
+		perror("Accept:");
+		return -1;
+	}
+
+	pthread_mutex_lock(&m);
+	// Step 1: Start a worker if the queue outgrows the idle ones
+	if (queue.size() >= idle && workers.size() < options.maxConnections) {
+		pthread_t id;
+		if (pthread_create(&id, NULL, work, this) == 0) {
+			workers.push_back(id);
+			idle++;
+		}
+	}
+
+	// Step 2: Queue the connection, or turn it away if queueLength
+	// connections are already waiting for a worker
+	if (queue.size() >= idle + options.queueLength) {
+		pthread_mutex_unlock(&m);
+		rejected++;
+		send(clientSoc, "ERROR_BUSY", sizeof("ERROR_BUSY"), MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(clientSoc);
+		return 0;
+	}
+	ClientSession * session;
+	if (pool.empty()) {
+		session = new ClientSession(roster, endSession);
+	} else {
+		session = pool.back();
+		pool.pop_back();
+	}
+	session->sockfd = clientSoc;
+	queue.push_back(session);
+	accepted++;
+	pthread_cond_signal(&ready);
+	pthread_mutex_unlock(&m);
+	return 0;
+}
+
+// The next queued session, or NULL once stopping with nothing queued
+ClientSession * TcpAcceptor::next() {
+	pthread_mutex_lock(&m);
+	while (queue.empty() && !stopping) {
+		pthread_cond_wait(&ready, &m);
+	}
+	ClientSession * session = NULL;
+	if (!queue.empty()) {
+		session = queue.front();
+		queue.pop_front();
+		idle--;
+	}
+	pthread_mutex_unlock(&m);
+	return session;
+}
+
+void TcpAcceptor::recycle(ClientSession * session) {
+	close(session->sockfd);
+	session->sockfd = -1;
+	session->in.clear();
+	session->out.clear();
+	if (session->in.capacity() > SESSION_BUFFER_KEEP) {
+		std::string().swap(session->in);
+	}
+	if (session->out.capacity() > SESSION_BUFFER_KEEP) {
+		std::string().swap(session->out);
+	}
+
+	pthread_mutex_lock(&m);
+	pool.push_back(session);
+	idle++;
+	pthread_mutex_unlock(&m);
+}
+
+void * TcpAcceptor::work(void * arg) {
+	TcpAcceptor * acceptor = (TcpAcceptor *) arg;
+	bindToLocalNode();
+	TraceBatch trace;
+	ClientSession * session;
+	while ((session = acceptor->next()) != NULL) {
+		if (serve(session, acceptor->options, trace)) {
+			acceptor->expired++;
+		}
+		acceptor->recycle(session);
+	}
+	return NULL;
+}
+
+void TcpAcceptor::join() {
+	pthread_mutex_lock(&m);
+	stopping = true;
+	pthread_cond_broadcast(&ready);
+	pthread_mutex_unlock(&m);
+
+	for (unsigned int i = 0; i < workers.size(); ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	workers.clear();
+}
@@ -0,0 +1,165 @@
+#ifndef TCP_HANDLER_H
+#define TCP_HANDLER_H
+
+#include <atomic>
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "roster.h"
+
+// END SESSION
+// Flag shared by every serving thread, set once STOP has been received
+// (it is written once and read often, so readers never contend on a lock)
+
+class EndSession {
+	std::atomic<bool> end_session;
+
+public:
+	EndSession(): end_session(false) {}
+
+	bool isSet() const {
+		return end_session.load(std::memory_order_acquire);
+	}
+	void set() {
+		end_session.store(true, std::memory_order_release);
+	}
+};
+
+
+// Longest request (or unterminated input) a connection may send: past
+// it the connection is sent ERROR_REQUEST_TOO_LONG and closed, so that a
+// client that never terminates its request can't grow the server's buffers
+#define MAX_REQUEST_BYTES 65536
+#define REQUEST_TOO_LONG "ERROR_REQUEST_TOO_LONG"
+
+
+// CONNECTION OPTIONS
+// --max-connections <n>  sessions served at once, one worker thread each
+//                        (default 256)
+// --conn-queue <n>       accepted connections left waiting for a worker
+//                        when all are busy (default 256); past that, new
+//                        connections are sent ERROR_BUSY and closed
+// --idle-timeout <ms>    close connections that send nothing for that long
+// --read-timeout <ms>    close connections that take that long to finish
+//                        sending a request they have started
+// --write-timeout <ms>   close connections that take none of their replies
+//                        for that long (default: the idle timeout)
+// Timeouts are off (0) by default. Reactors keep their connections'
+// deadlines on a timer wheel (see timerWheel.h); a pool worker serves one
+// connection at a time, so it needs no wheel: it waits in select() (or
+// poll(), for a write) no longer than that connection's own deadline
+
+struct ConnectionOptions {
+	size_t maxConnections;
+	size_t queueLength;
+	uint64_t idleTimeoutMs;
+	uint64_t readTimeoutMs;
+	uint64_t writeTimeoutMs;
+
+	ConnectionOptions(): maxConnections(256), queueLength(256), idleTimeoutMs(0), readTimeoutMs(0), writeTimeoutMs(0) {}
+
+	uint64_t writeLimit() const {
+		return writeTimeoutMs ? writeTimeoutMs : idleTimeoutMs;
+	}
+	bool timeouts() const {
+		return idleTimeoutMs || readTimeoutMs || writeTimeoutMs;
+	}
+
+	// When a connection last heard from at lastActivity, with a partial
+	// request pending since partialSince and replies the client hasn't
+	// taken since blockedSince (either 0 if none), times out
+	// Returns 0 if it never does
+	uint64_t deadline(uint64_t lastActivity, uint64_t partialSince, uint64_t blockedSince = 0) const {
+		uint64_t d = idleTimeoutMs ? lastActivity + idleTimeoutMs : 0;
+		if (partialSince && readTimeoutMs) {
+			d = partialSince + readTimeoutMs;
+		}
+		if (blockedSince && writeLimit() && (!d || blockedSince + writeLimit() < d)) {
+			d = blockedSince + writeLimit();
+		}
+		return d;
+	}
+};
+
+// Consumes argv[i] (and its value) if it is a connection option
+// Returns false if argv[i] is not a (well-formed) connection option
+bool parseConnectionOption(int argc, char * argv[], int & i, ConnectionOptions & options);
+
+// Usage string for the connection options
+extern const char * CONNECTION_USAGE;
+
+
+// CLIENT SESSION
+// One TCP connection, from accept() to close(). Sessions are recycled
+// through the acceptor's pool, buffers and all
+
+struct ClientSession {
+	int sockfd;							// client socket
+	Roster * roster;					// storage engine
+	EndSession * endSession;			// shared memory, flag for STOP signal
+	std::string in;						// bytes received but not yet parsed
+	std::string out;					// replies to the last read
+
+	ClientSession(Roster * roster, EndSession * endSession):
+		sockfd(-1),
+		roster(roster),
+		endSession(endSession)
+	{}
+};
+
+
+// TCP ACCEPTOR
+// Accepts connections on a listening socket and hands each to a worker
+// thread, which serves it until it closes and then takes the next
+//
+// Workers are started as needed, up to maxConnections, and wait for work
+// once idle rather than exit, so that no thread is created or joined per
+// connection. Connections that find every worker busy queue up (at most
+// queueLength of them); the rest are rejected. Finished sessions go back
+// to a pool. Threads, sessions and queue are all bounded, so memory stays
+// flat however many connections come and go
+
+class TcpAcceptor {
+	int soc;
+	Roster * roster;
+	EndSession * endSession;
+	ConnectionOptions options;
+
+	pthread_mutex_t m;
+	pthread_cond_t ready;				// signalled when a session is queued
+	std::vector<pthread_t> workers;
+	size_t idle;						// workers waiting for a session
+	std::deque<ClientSession *> queue;	// accepted, waiting for a worker
+	std::vector<ClientSession *> pool;	// finished sessions, for reuse
+	bool stopping;
+
+	static void * work(void * arg);
+	ClientSession * next();
+	void recycle(ClientSession * session);
+
+public:
+	uint64_t accepted;
+	uint64_t rejected;
+	std::atomic<uint64_t> expired;		// closed by a timeout
+
+	TcpAcceptor(int soc, Roster * roster, EndSession * endSession, const ConnectionOptions & options);
+	~TcpAcceptor();
+
+	// Accept one pending connection and queue it for a worker
+	// Returns 0 on success (or if there was nothing to accept) and -1 on error
+	int acceptClient() {
+		return acceptClient(soc);
+	}
+	// The same, on another listening socket (one handed off by a reactor
+	// server has several, see handoff.h)
+	int acceptClient(int listener);
+
+	// Serve the queued connections, then join the workers (call once STOP
+	// has been sent, or on handoff to drain the sessions in progress)
+	void join();
+};
+
+#endif
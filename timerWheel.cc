@@ -0,0 +1,97 @@
+#include <time.h>
+#include "timerWheel.h"
+
+uint64_t monotonicMillis() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// TIMER WHEEL
+
+TimerWheel::TimerWheel(size_t slotCount, uint64_t tickMs, uint64_t nowMs):
+	slots(slotCount),
+	tickMs(tickMs ? tickMs : 1),
+	nextTick(nowMs / this->tickMs),
+	count(0)
+{
+	for (size_t i = 0; i < slots.size(); i++) {
+		slots[i].prev = slots[i].next = &slots[i];
+	}
+}
+
+void TimerWheel::link(TimerNode * node) {
+	// Never behind the hand, or the timer would wait for a whole revolution
+	uint64_t tick = node->deadline / tickMs;
+	if (tick < nextTick) {
+		tick = nextTick;
+	}
+	TimerNode * head = &slots[tick & (slots.size() - 1)];
+	node->prev = head->prev;
+	node->next = head;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+void TimerWheel::unlink(TimerNode * node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = node->next = NULL;
+}
+
+void TimerWheel::schedule(TimerNode * node, uint64_t deadline) {
+	if (node->scheduled()) {
+		unlink(node);
+	} else {
+		count++;
+	}
+	node->deadline = deadline;
+	link(node);
+}
+
+void TimerWheel::cancel(TimerNode * node) {
+	if (node->scheduled()) {
+		unlink(node);
+		count--;
+	}
+}
+
+size_t TimerWheel::advance(uint64_t nowMs, TimerExpired expired, void * arg) {
+	uint64_t nowTick = nowMs / tickMs;
+	size_t n = 0;
+
+	// After a long sleep, one revolution visits every slot
+	uint64_t first = nextTick;
+	if (nowTick >= first + slots.size()) {
+		first = nowTick - slots.size() + 1;
+	}
+	for (uint64_t tick = first; tick <= nowTick; tick++) {
+		TimerNode * head = &slots[tick & (slots.size() - 1)];
+
+		// Detach the slot first: timers that aren't due may go back into it
+		TimerNode pending;
+		if (head->next == head) {
+			continue;
+		}
+		pending.next = head->next;
+		pending.prev = head->prev;
+		pending.next->prev = &pending;
+		pending.prev->next = &pending;
+		head->prev = head->next = head;
+
+		nextTick = tick + 1;
+		while (pending.next != &pending) {
+			TimerNode * node = pending.next;
+			unlink(node);
+			if (node->deadline <= nowMs) {
+				count--;
+				expired(arg, node);
+				n++;
+			} else {
+				link(node);
+			}
+		}
+	}
+	nextTick = nowTick + 1;
+	return n;
+}
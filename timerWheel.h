@@ -0,0 +1,79 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// TIMER WHEEL
+// Hashed timing wheel for the connection timeouts of a reactor
+//
+// Time is cut in ticks of tickMs; a timer goes in the slot of its deadline's
+// tick, modulo the number of slots, and the wheel visits one slot per tick
+// (driven by a timerfd, see reactor.h). Scheduling and cancelling unlink or
+// link one node: O(1) however many timers there are. A timer more than one
+// revolution away is visited early and simply put back
+//
+// Connections push their deadline back on every request. That only stores
+// the new deadline (see touch()): the node stays where it is, and is moved
+// when its old slot comes up, so a busy connection costs one relink per
+// timeout period rather than one per request
+
+struct TimerNode {
+	TimerNode * prev;
+	TimerNode * next;
+	uint64_t deadline;					// ms, CLOCK_MONOTONIC
+
+	TimerNode(): prev(NULL), next(NULL), deadline(0) {}
+
+	bool scheduled() const {
+		return next != NULL;
+	}
+};
+
+// Called for every expired timer, once it has been unlinked
+typedef void (*TimerExpired)(void * arg, TimerNode * node);
+
+class TimerWheel {
+	std::vector<TimerNode> slots;		// list heads
+	uint64_t tickMs;
+	uint64_t nextTick;					// the first tick not visited yet
+	size_t count;
+
+	void link(TimerNode * node);
+	static void unlink(TimerNode * node);
+
+public:
+	// slots must be a power of two
+	TimerWheel(size_t slots, uint64_t tickMs, uint64_t nowMs);
+
+	// Sets (or resets) node's deadline
+	void schedule(TimerNode * node, uint64_t deadline);
+
+	// Moves node's deadline; later deadlines are only recorded
+	void touch(TimerNode * node, uint64_t deadline) {
+		if (deadline >= node->deadline && node->scheduled()) {
+			node->deadline = deadline;
+		} else {
+			schedule(node, deadline);
+		}
+	}
+
+	void cancel(TimerNode * node);
+
+	// Visits the slots up to nowMs and expires the timers that are due
+	// Returns the number of timers expired
+	size_t advance(uint64_t nowMs, TimerExpired expired, void * arg);
+
+	size_t size() const {
+		return count;
+	}
+	uint64_t tick() const {
+		return tickMs;
+	}
+};
+
+// CLOCK_MONOTONIC in milliseconds
+uint64_t monotonicMillis();
+
+#endif
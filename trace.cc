@@ -0,0 +1,283 @@
+#include <errno.h>
+#include <iostream>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "trace.h"
+
+// Records each serving thread can hold until the next dump
+#define TRACE_RING_RECORDS 4096
+
+std::atomic<unsigned int> traceEvery(0);
+
+uint64_t traceNow() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void traceSetEvery(unsigned int every) {
+	traceEvery.store(every, std::memory_order_relaxed);
+}
+
+
+// TRACE RINGS
+// One per serving thread; a thread that exits leaves its ring (and the
+// records still in it) to the next thread that samples a request
+
+struct TraceRing {
+	std::atomic<uint64_t> head;			// written by the serving thread
+	std::atomic<uint64_t> tail;			// written by the dump
+	bool used;							// owned by a thread (under ringsLock)
+	TraceRecord records[TRACE_RING_RECORDS];
+
+	TraceRing(): head(0), tail(0), used(true) {}
+};
+
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<TraceRing *> rings;
+static std::atomic<uint64_t> dropped(0);
+
+struct RingOwner {
+	TraceRing * ring;
+	uint32_t tid;
+	unsigned int countdown;				// requests until the next sample
+
+	RingOwner(): ring(NULL), tid(0), countdown(0) {}
+	~RingOwner() {
+		if (ring) {
+			pthread_mutex_lock(&ringsLock);
+			ring->used = false;
+			pthread_mutex_unlock(&ringsLock);
+		}
+	}
+
+	TraceRing * acquire() {
+		pthread_mutex_lock(&ringsLock);
+		for (size_t i = 0; i < rings.size() && !ring; i++) {
+			if (!rings[i]->used) {
+				ring = rings[i];
+				ring->used = true;
+			}
+		}
+		if (!ring) {
+			ring = new TraceRing();
+			rings.push_back(ring);
+		}
+		pthread_mutex_unlock(&ringsLock);
+		tid = syscall(SYS_gettid);
+		return ring;
+	}
+};
+
+static thread_local RingOwner owner;
+
+static void push(TraceRecord & record) {
+	TraceRing * ring = owner.ring ? owner.ring : owner.acquire();
+	record.tid = owner.tid;
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	if (head - ring->tail.load(std::memory_order_acquire) >= TRACE_RING_RECORDS) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	ring->records[head % TRACE_RING_RECORDS] = record;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+
+// TRACE BATCH
+
+void TraceBatch::received(uint64_t arrival) {
+	if (on) {
+		arrive = arrival;
+		read = traceNow();
+	}
+}
+
+TraceRecord * TraceBatch::sample() {
+	unsigned int every = traceEvery.load(std::memory_order_relaxed);
+	if (count == sizeof(pending) / sizeof(pending[0]) || every == 0) {
+		return NULL;
+	}
+	if (owner.countdown == 0 || owner.countdown > every) {
+		owner.countdown = every;
+	}
+	if (--owner.countdown) {
+		return NULL;
+	}
+
+	TraceRecord * record = &pending[count];
+	memset(record, 0, sizeof(TraceRecord));
+	record->stamps[TRACE_ARRIVE] = arrive;
+	record->stamps[TRACE_WAKE] = wake;
+	record->stamps[TRACE_READ] = read;
+	record->stamps[TRACE_START] = traceNow();
+	return record;
+}
+
+void TraceBatch::stamp(const InputBuffer & inputBuffer) {
+	current->stamps[TRACE_PARSE] = traceNow();
+	current->op = inputBuffer.hasGet() ? 'G'
+		: inputBuffer.hasPut() ? 'P'
+		: inputBuffer.hasDel() ? 'D'
+		: inputBuffer.hasTrace() ? 'T'
+		: 'E';
+}
+
+void TraceBatch::commit() {
+	uint64_t now = traceNow();
+	for (unsigned int i = 0; i < count; i++) {
+		pending[i].stamps[TRACE_WRITE] = now;
+		push(pending[i]);
+	}
+	count = 0;
+}
+
+
+// ARRIVAL STAMPS
+
+uint64_t traceArrival(int fd, msghdr * msg) {
+	for (cmsghdr * cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			// The kernel stamps with the wall clock: shift it onto the monotonic one
+			timespec arrived, real;
+			memcpy(&arrived, CMSG_DATA(cmsg), sizeof(arrived));
+			clock_gettime(CLOCK_REALTIME, &real);
+			uint64_t now = traceNow();
+			int64_t age = ((int64_t) real.tv_sec - arrived.tv_sec) * 1000000000ll + (real.tv_nsec - arrived.tv_nsec);
+			return age < 0 ? now : now - age;
+		}
+	}
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+	return 0;
+}
+
+int traceRead(int fd, char * buf, size_t len, uint64_t * arrival) {
+	iovec iov = {buf, len};
+	char control[TRACE_CONTROL_LEN];
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	int l = recvmsg(fd, &msg, 0);
+	if (l > 0) {
+		*arrival = traceArrival(fd, &msg);
+	}
+	return l;
+}
+
+
+// DUMPS
+
+static pthread_mutex_t dumpLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int dumps = 0;
+
+static const char * STAGE_NAMES[TRACE_STAGES] = {
+	"arrive", "wakeup", "read", "queued", "parse", "execute", "write"
+};
+
+static const char * opName(char op) {
+	switch (op) {
+		case 'G': return "GET";
+		case 'P': return "PUT";
+		case 'D': return "DEL";
+		case 'T': return "TRACE";
+		default: return "INVALID";
+	}
+}
+
+// One complete ("X") event, in microseconds
+static void writeEvent(FILE * out, bool & first, const char * name, const char * cat, uint64_t from, uint64_t to, uint32_t tid) {
+	fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+		first ? "" : ",", name, cat, from / 1000.0, (to > from ? to - from : 0) / 1000.0, (int) getpid(), tid);
+	first = false;
+}
+
+std::string traceDump() {
+	pthread_mutex_lock(&dumpLock);
+	char path[64];
+	snprintf(path, sizeof(path), "trace-%d-%u.json", (int) getpid(), ++dumps);
+	FILE * out = fopen(path, "w");
+	if (out == NULL) {
+		perror("Trace:");
+		pthread_mutex_unlock(&dumpLock);
+		return "";
+	}
+
+	pthread_mutex_lock(&ringsLock);
+	std::vector<TraceRing *> snapshot(rings);
+	pthread_mutex_unlock(&ringsLock);
+
+	// Each request is one event covering its stages, which nest under it
+	fprintf(out, "{\"traceEvents\":[");
+	bool first = true;
+	size_t records = 0;
+	for (size_t i = 0; i < snapshot.size(); i++) {
+		TraceRing * ring = snapshot[i];
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		for (; tail != head; tail++, records++) {
+			const TraceRecord & r = ring->records[tail % TRACE_RING_RECORDS];
+			int begin = r.stamps[TRACE_ARRIVE] ? TRACE_ARRIVE : TRACE_WAKE;
+			writeEvent(out, first, opName(r.op), "request", r.stamps[begin], r.stamps[TRACE_WRITE], r.tid);
+			for (int s = begin + 1; s < TRACE_STAGES; s++) {
+				writeEvent(out, first, STAGE_NAMES[s], opName(r.op), r.stamps[s - 1], r.stamps[s], r.tid);
+			}
+		}
+		ring->tail.store(head, std::memory_order_release);
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu}}\n",
+		(unsigned long long) dropped.exchange(0));
+
+	bool failed = ferror(out);
+	if (fclose(out) != 0 || failed) {
+		perror("Trace:");
+		pthread_mutex_unlock(&dumpLock);
+		return "";
+	}
+	pthread_mutex_unlock(&dumpLock);
+	std::cerr << "Trace: wrote " << records << " requests to " << path << std::endl;
+	return path;
+}
+
+static void * runDumper(void * arg) {
+	sigset_t * signals = (sigset_t *) arg;
+	while (1) {
+		int sig;
+		if (sigwait(signals, &sig) == 0) {
+			traceDump();
+		}
+	}
+	return NULL;
+}
+
+int traceStart(unsigned int every) {
+	// SIGUSR1 is only ever taken by the dumper (which may do I/O),
+	// and never interrupts a serving thread's select()
+	static sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+		perror("Trace:");
+		return -1;
+	}
+
+	pthread_t dumper;
+	if (pthread_create(&dumper, NULL, runDumper, &signals) != 0) {
+		perror("Trace:");
+		return -1;
+	}
+	pthread_detach(dumper);
+	traceSetEvery(every);
+	return 0;
+}
@@ -0,0 +1,129 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include "common.h"
+
+// REQUEST TRACING
+// Timestamps the stages of one request in every <n> (--trace <n>, or the
+// TRACE <n> admin command; 0 turns sampling off), to tell where the time
+// of a slow request went:
+//
+//   arrive -> wake      the kernel received it -> the server's select()/
+//                       epoll_wait() returned (SO_TIMESTAMPNS; the first
+//                       sampled read of a socket turns it on)
+//   wake -> read        read()/recvmsg()
+//   read -> start       earlier commands of the same read
+//   start -> parse      InputBuffer
+//   parse -> execute    roster lookup or update
+//   execute -> write    the rest of the batch, and write()/sendmsg()
+//
+// Each serving thread appends its records to its own lock-free ring
+// (single producer, single consumer), dropping them while the ring is
+// full. SIGUSR1 or the TRACE admin command drains every ring into
+// ./trace-<pid>-<n>.json, in the Chrome trace format (chrome://tracing,
+// ui.perfetto.dev). With sampling off, a serving thread only loads one
+// flag per wakeup
+
+enum TraceStage {
+	TRACE_ARRIVE,
+	TRACE_WAKE,
+	TRACE_READ,
+	TRACE_START,
+	TRACE_PARSE,
+	TRACE_EXECUTE,
+	TRACE_WRITE,
+	TRACE_STAGES
+};
+
+struct TraceRecord {
+	uint64_t stamps[TRACE_STAGES];		// monotonic ns, 0 if unknown
+	uint32_t tid;
+	char op;							// 'G', 'P', 'D', 'T' (TRACE) or 'E' (invalid)
+};
+
+// Sample one request in every traceEvery; 0 when tracing is off
+extern std::atomic<unsigned int> traceEvery;
+
+inline bool traceEnabled() {
+	return traceEvery.load(std::memory_order_relaxed) != 0;
+}
+
+// Nanoseconds on the monotonic clock
+uint64_t traceNow();
+
+// Sets the sampling rate (0: off)
+void traceSetEvery(unsigned int every);
+
+// Blocks SIGUSR1 and starts the thread dumping the traces on it, then sets
+// the sampling rate; call before starting any other thread
+// Returns 0 on success and -1 on error
+int traceStart(unsigned int every);
+
+// Writes (and discards) every record collected so far
+// Returns the path of the trace file, or "" on error
+std::string traceDump();
+
+// When the kernel received the data just read by recvmsg(msg), as a
+// monotonic stamp (0 if unknown); msg needs TRACE_CONTROL_LEN bytes of
+// control space. Turns on SO_TIMESTAMPNS on fd if it isn't yet
+uint64_t traceArrival(int fd, msghdr * msg);
+#define TRACE_CONTROL_LEN 64
+
+// read() that also returns the arrival stamp (see traceArrival())
+int traceRead(int fd, char * buf, size_t len, uint64_t * arrival);
+
+// The stages of the requests served after one wakeup. Sampled requests
+// are kept until their replies have been written
+class TraceBatch {
+	bool on;
+	uint64_t arrive, wake, read;
+	TraceRecord pending[64];
+	unsigned int count;
+	TraceRecord * current;				// the command being served, if sampled
+
+public:
+	TraceBatch(): on(false), count(0), current(NULL) {}
+
+	bool enabled() const {
+		return on;
+	}
+
+	// The server's select()/epoll_wait() returned
+	void woke() {
+		on = traceEnabled();
+		if (on) {
+			wake = traceNow();
+		}
+	}
+	// Data was read, the kernel got it at arrival (or 0)
+	void received(uint64_t arrival);
+	// A command is about to be parsed, decides whether it is sampled
+	void start() {
+		current = on ? sample() : NULL;
+	}
+	void parsed(const InputBuffer & inputBuffer) {
+		if (current) stamp(inputBuffer);
+	}
+	void executed() {
+		if (current) {
+			current->stamps[TRACE_EXECUTE] = traceNow();
+			count++;
+			current = NULL;
+		}
+	}
+	// The replies went out: commit the sampled requests
+	void written() {
+		if (count) commit();
+	}
+
+private:
+	TraceRecord * sample();
+	void stamp(const InputBuffer & inputBuffer);
+	void commit();
+};
+
+#endif
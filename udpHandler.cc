@@ -0,0 +1,313 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "udpHandler.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef IP_MTU
+#define IP_MTU 14
+#endif
+
+// Kernel limits on a single GSO send (see UDP_MAX_SEGMENTS in linux/udp.h)
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65000
+
+// Largest segment when the path MTU is unknown: a 1500 byte Ethernet MTU,
+// less the IPv4 and UDP headers
+#define GSO_DEFAULT_SEGMENT 1472
+#define UDP_IP_HEADER_BYTES 28
+
+// Path MTUs cached, by client address, and for how long (it can change)
+#define MTU_CACHE_SIZE 256
+#define MTU_CACHE_MICROS 10000000
+
+// Largest UDP payload, and therefore the largest GRO burst
+#define RECV_BUF_LEN 65536
+
+// Most datagrams handle() drops before it returns to the caller's select()
+#define UDP_MAX_DROPS 64
+
+// UDP CLIENT HANDLER
+
+static uint64_t nowMicros() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+UdpHandler::UdpHandler(int sockfd, Roster * roster, const RateLimitOptions & rateLimitOptions):
+	sockfd(sockfd),
+	roster(roster),
+	buf(RECV_BUF_LEN),
+	limiter(rateLimitOptions),
+	mtuProbe(-1),
+	mtus(MTU_CACHE_SIZE)
+{
+	int one = 1;
+	gro = setsockopt(sockfd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+	// Setting a zero segment size keeps the default (no segmentation)
+	// but fails with ENOPROTOOPT on kernels without UDP GSO
+	int zero = 0;
+	gso = setsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+	if (gso) {
+		mtuProbe = socket(AF_INET, SOCK_DGRAM, 0);
+	}
+}
+
+UdpHandler::~UdpHandler() {
+	if (mtuProbe >= 0) {
+		close(mtuProbe);
+	}
+}
+
+size_t UdpHandler::maxSegment(const sockaddr * clientAddr) {
+	if (mtuProbe < 0 || clientAddr->sa_family != AF_INET) {
+		return GSO_DEFAULT_SEGMENT;
+	}
+	uint32_t addr = ((const sockaddr_in *) clientAddr)->sin_addr.s_addr;
+	PathMtu & cached = mtus[((addr * 0x9e3779b1u) >> 8) % MTU_CACHE_SIZE];
+	uint64_t now = nowMicros();
+	if (cached.expires > now && cached.addr == addr) {
+		return cached.segment;
+	}
+
+	// The server socket is unconnected, so IP_MTU is read from the probe
+	// socket once connected to the client (which sends nothing)
+	cached.addr = addr;
+	cached.expires = now + MTU_CACHE_MICROS;
+	cached.segment = GSO_DEFAULT_SEGMENT;
+	int mtu = 0;
+	socklen_t mtuLen = sizeof(mtu);
+	if (connect(mtuProbe, clientAddr, sizeof(sockaddr_in)) == 0
+		&& getsockopt(mtuProbe, IPPROTO_IP, IP_MTU, &mtu, &mtuLen) == 0 && mtu > UDP_IP_HEADER_BYTES) {
+		cached.segment = mtu - UDP_IP_HEADER_BYTES;
+	}
+	return cached.segment;
+}
+
+int UdpHandler::handle() {
+	// Read the incoming UDP request, along with the GRO segment size if any
+	// (and its arrival time when tracing)
+	trace.woke();
+	sockaddr clientAddr;
+	iovec iov = {&buf[0], buf.size()};
+	char control[CMSG_SPACE(sizeof(int)) + TRACE_CONTROL_LEN];
+	msghdr msg;
+	int l;
+	size_t segSize, admitted;
+
+	// Datagrams over quota are dropped unread, and the next one is
+	// read right away, so that a flood is shed with one call per burst
+	for (int drops = 0; ; drops++) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &clientAddr;
+		msg.msg_namelen = sizeof(sockaddr);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		// Don't block: another process may share the socket during a handoff
+		l = recvmsg(sockfd, &msg, MSG_DONTWAIT);
+		if (l < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				return 0;
+			}
+			perror("recvmsg:");
+			return -1;
+		}
+		// An empty datagram ends serving, as STOP does, once admitted
+		segSize = l ? l : 1;
+		for (cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+				int gsoSize;
+				memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+				if (gsoSize > 0) {
+					segSize = gsoSize;
+				}
+			}
+		}
+
+		// Admission control, before anything is parsed
+		size_t segments = l ? (l + segSize - 1) / segSize : 1;
+		admitted = segments;
+		if (limiter.enabled() && clientAddr.sa_family == AF_INET) {
+			admitted = limiter.admit(((sockaddr_in *) &clientAddr)->sin_addr.s_addr, nowMicros(), segments);
+		} else {
+			limiter.received += segments;
+		}
+		if (admitted) {
+			break;
+		}
+		if (drops == UDP_MAX_DROPS) {
+			return 0;
+		}
+	}
+	if (!l) {
+		return limiter.stopAllowed() ? 1 : 0;
+	}
+	trace.received(trace.enabled() ? traceArrival(sockfd, &msg) : 0);
+
+	// Every segment of a GRO burst is one request datagram from the same client
+	std::vector<std::string> replies;
+	int retCode = 0;
+	size_t end = admitted * segSize < (size_t) l ? admitted * segSize : l;
+	for (size_t off = 0; off < end && !retCode; off += segSize) {
+		size_t len = end - off < segSize ? end - off : segSize;
+		std::string bufstr(&buf[off], strnlen(&buf[off], len));
+		InputBuffer inputBuffer(bufstr);
+
+		for (trace.start(); inputBuffer.next(); trace.start()) {
+			trace.parsed(inputBuffer);
+			// STOP case (stop() == true implies stopSession() == true),
+			// ignored when rate limits are set without --udp-allow-stop
+			if (inputBuffer.stop() && limiter.stopAllowed()) {
+				retCode = 1;
+				break;
+			}
+			// UDP server doesn't need to handle STOP_SESSION
+			if (inputBuffer.stopSession()) {
+				continue;
+			}
+			// The admission counters
+			if (inputBuffer.stats()) {
+				std::string tag = inputBuffer.getTag();
+				replies.push_back((tag.empty() ? "" : tag + " ") + "OK " + limiter.stats());
+				continue;
+			}
+
+			// GET and error cases
+			std::string reply;
+			if (execute(inputBuffer, roster, reply)) {
+				replies.push_back(reply);
+			}
+			trace.executed();
+		}
+	}
+
+	sendReplies(replies, &clientAddr, msg.msg_namelen);
+	trace.written();
+	return retCode;
+}
+
+void UdpHandler::sendReplies(
+	const std::vector<std::string> & replies,
+	const sockaddr * clientAddr,
+	socklen_t clientAddrLen
+) {
+	// Replies that go out as individual datagrams are batched into one sendmmsg()
+	std::vector<iovec> iovs(replies.size());
+	std::vector<mmsghdr> pending;
+	size_t segmentLimit = gso && replies.size() > 1 ? maxSegment(clientAddr) : 0;
+
+	size_t i = 0;
+	while (i < replies.size() || !pending.empty()) {
+		// Find the run of replies starting at i that one GSO send can carry:
+		// every segment has the size of the first (which must fit the MTU),
+		// except a shorter last one
+		size_t count = 0;
+		if (i < replies.size()) {
+			size_t segSize = replies[i].length(), total = segSize;
+			for (count = 1; gso && segSize <= segmentLimit && i + count < replies.size() && count < GSO_MAX_SEGMENTS; ) {
+				size_t len = replies[i + count].length();
+				if (len > segSize || total + len > GSO_MAX_BYTES) break;
+				total += len;
+				count++;
+				if (len < segSize) break;
+			}
+		}
+
+		// Flush individual datagrams before a GSO send (to keep replies in order)
+		// and once every reply has been queued
+		if ((count > 1 || i == replies.size()) && !pending.empty()) {
+			for (size_t sent = 0; sent < pending.size(); ) {
+				int n = sendmmsg(sockfd, &pending[sent], pending.size() - sent, 0);
+				if (n <= 0) {
+					perror("sendmmsg:");
+					break;
+				}
+				sent += n;
+			}
+			pending.clear();
+		}
+		if (i == replies.size()) {
+			break;
+		}
+
+		if (count > 1 && sendSegments(replies, i, count, clientAddr, clientAddrLen)) {
+			i += count;
+			continue;
+		}
+
+		// Plain datagrams, for a single reply or a run the kernel refused
+		for (size_t end = i + count; i < end; i++) {
+			iovs[i].iov_base = (void *) replies[i].c_str();
+			iovs[i].iov_len = replies[i].length();
+			mmsghdr m;
+			memset(&m, 0, sizeof(m));
+			m.msg_hdr.msg_name = (void *) clientAddr;
+			m.msg_hdr.msg_namelen = clientAddrLen;
+			m.msg_hdr.msg_iov = &iovs[i];
+			m.msg_hdr.msg_iovlen = 1;
+			pending.push_back(m);
+		}
+	}
+}
+
+bool UdpHandler::sendSegments(
+	const std::vector<std::string> & replies,
+	size_t first,
+	size_t count,
+	const sockaddr * clientAddr,
+	socklen_t clientAddrLen
+) {
+	std::vector<iovec> iovs(count);
+	for (size_t k = 0; k < count; k++) {
+		iovs[k].iov_base = (void *) replies[first + k].c_str();
+		iovs[k].iov_len = replies[first + k].length();
+	}
+
+	char control[CMSG_SPACE(sizeof(uint16_t))];
+	memset(control, 0, sizeof(control));
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void *) clientAddr;
+	msg.msg_namelen = clientAddrLen;
+	msg.msg_iov = &iovs[0];
+	msg.msg_iovlen = count;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	uint16_t segSize = replies[first].length();
+	memcpy(CMSG_DATA(cmsg), &segSize, sizeof(segSize));
+
+	if (sendmsg(sockfd, &msg, 0) < 0) {
+		// EIO: the device can't checksum/segment; stop trying GSO on this socket
+		// (EINVAL, such as a segment over this client's MTU, fails this run only)
+		if (errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+			gso = false;
+		}
+		return false;
+	}
+	return true;
+}
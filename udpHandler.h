@@ -0,0 +1,79 @@
+#ifndef UDP_HANDLER_H
+#define UDP_HANDLER_H
+
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+#include "common.h"
+#include "rateLimit.h"
+#include "roster.h"
+#include "trace.h"
+
+// UDP CLIENT HANDLER
+// Serves UDP requests, batching datagrams through the kernel's UDP
+// segmentation offloads when they are available:
+//  - UDP_GRO lets one recvmsg() return a burst of datagrams from one client
+//  - UDP_SEGMENT (GSO) lets one sendmsg() carry many replies to one client,
+//    as long as each fits the client's path MTU (IP_MTU, read per client
+//    through a connected probe socket and cached)
+// Both are probed at construction and dropped at runtime if the kernel
+// rejects them, in which case every datagram is sent/received on its own
+
+class UdpHandler {
+	int sockfd;
+	Roster * roster;
+	bool gro;							// UDP_GRO enabled on sockfd
+	bool gso;							// UDP_SEGMENT usable on sockfd
+	std::vector<char> buf;				// receive buffer, large enough for a GRO burst
+	TraceBatch trace;
+	RateLimiter limiter;
+
+	// A client's path MTU, less the headers: the largest GSO segment to it
+	struct PathMtu {
+		uint32_t addr;
+		size_t segment;
+		uint64_t expires;				// microseconds, 0 if unused
+		PathMtu(): addr(0), segment(0), expires(0) {}
+	};
+	int mtuProbe;						// UDP socket connected to a client to read IP_MTU
+	std::vector<PathMtu> mtus;			// direct-mapped by address
+
+	size_t maxSegment(const sockaddr * clientAddr);
+
+	// Sends replies (in order) to clientAddr
+	void sendReplies(
+		const std::vector<std::string> & replies,
+		const sockaddr * clientAddr,
+		socklen_t clientAddrLen
+	);
+
+	// Sends replies[first .. first + count) as one GSO datagram train
+	// Returns false if the kernel refused it, in which case they are to be
+	// sent as plain datagrams
+	bool sendSegments(
+		const std::vector<std::string> & replies,
+		size_t first,
+		size_t count,
+		const sockaddr * clientAddr,
+		socklen_t clientAddrLen
+	);
+
+public:
+	UdpHandler(int sockfd, Roster * roster, const RateLimitOptions & rateLimitOptions = RateLimitOptions());
+	~UdpHandler();
+
+	// Reads one UDP request (or GRO burst of requests) from sockfd, if one
+	// is waiting, and sends back the replies; requests over the rate limits
+	// are dropped (see rateLimit.h). STATS is answered with the counters
+	// Returns 1 if STOP was received (and obeyed, see rateLimit.h), 0 on
+	// success and -1 on error
+	int handle();
+
+	// The admission counters (see RateLimiter::stats())
+	std::string stats() const {
+		return limiter.stats();
+	}
+};
+
+#endif
@@ -0,0 +1,492 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "wal.h"
+
+// Most records the flusher commits with one fdatasync()
+#define WAL_MAX_BATCH 4096
+
+// WAL RECORDS
+
+static uint32_t crc32(const std::string & data) {
+	static uint32_t table[256];
+	static bool init = false;
+	if (!init) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) {
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+		init = true;
+	}
+
+	uint32_t crc = 0xffffffffu;
+	for (size_t i = 0; i < data.length(); i++) {
+		crc = table[(crc ^ (unsigned char) data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffffu;
+}
+
+std::string encodeRecord(const WalRecord & record) {
+	std::string body;
+	body += record.op;
+	body += " " + record.groupId + " " + record.studentId;
+	if (record.op == 'P') {
+		body += " " + record.studentName;
+	}
+	char crc[16];
+	snprintf(crc, sizeof(crc), "%08x ", crc32(body));
+	return crc + body + "\n";
+}
+
+bool decodeRecord(const std::string & line, WalRecord & record) {
+	if (line.length() < 9 || line[8] != ' ') {
+		return false;
+	}
+	std::string body = line.substr(9);
+	char * end;
+	uint32_t crc = strtoul(line.substr(0, 8).c_str(), &end, 16);
+	if (*end || crc != crc32(body)) {
+		return false;
+	}
+
+	std::stringstream ss(body);
+	std::string op;
+	ss >> op >> record.groupId >> record.studentId;
+	record.studentName.clear();
+	if (op == "P") {
+		std::getline(ss >> std::ws, record.studentName);
+	}
+	record.op = op.empty() ? 0 : op[0];
+	return ss && (op == "D" || (op == "P" && !record.studentName.empty()));
+}
+
+
+// DURABLE ROSTER
+
+static uint64_t nowNanos() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Makes a rename() or file creation in dir durable
+static int syncDir(const std::string & dir) {
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		return -1;
+	}
+	int ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+DurableRoster::DurableRoster(ConcurrentRoster * index, const std::string & dir, long syncDelayMicros, size_t checkpointBytes):
+	index(index),
+	dir(dir),
+	syncDelayMicros(syncDelayMicros),
+	checkpointBytes(checkpointBytes),
+	logFd(-1),
+	logBytes(0),
+	flusherStarted(false),
+	stopping(false),
+	failed(false),
+	checkpointerStarted(false),
+	folding(false),
+	checkpointerStopping(false)
+{
+	pthread_mutex_init(&m, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&queued, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&flushed, NULL);
+	pthread_mutex_init(&checkpointM, NULL);
+	pthread_cond_init(&checkpointDue, NULL);
+}
+
+DurableRoster::~DurableRoster() {
+	// Commit whatever is still queued, then stop the flusher
+	if (flusherStarted) {
+		pthread_mutex_lock(&m);
+		stopping = true;
+		pthread_cond_signal(&queued);
+		pthread_mutex_unlock(&m);
+		pthread_join(flusher, NULL);
+	}
+	// Then let the checkpointer finish the checkpoint it has been given
+	if (checkpointerStarted) {
+		pthread_mutex_lock(&checkpointM);
+		checkpointerStopping = true;
+		pthread_cond_signal(&checkpointDue);
+		pthread_mutex_unlock(&checkpointM);
+		pthread_join(checkpointer, NULL);
+	}
+	if (logFd >= 0) {
+		close(logFd);
+	}
+	pthread_cond_destroy(&queued);
+	pthread_cond_destroy(&flushed);
+	pthread_mutex_destroy(&m);
+	pthread_cond_destroy(&checkpointDue);
+	pthread_mutex_destroy(&checkpointM);
+	delete index;
+}
+
+// Applies a (durable) change to the index
+int DurableRoster::apply(const WalRecord & record) {
+	if (record.op == 'P') {
+		return index->put(record.groupId, record.studentId, record.studentName) ? 1 : -1;
+	}
+	return index->del(record.groupId, record.studentId);
+}
+
+// Applies every record of the file at path
+// Returns the number of valid bytes (the file is cut there if truncateTail), or -1
+long DurableRoster::replay(const std::string & path, bool truncateTail) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	std::string line;
+	size_t valid = 0, records = 0;
+	WalRecord record;
+	while (std::getline(in, line) && !in.eof() && decodeRecord(line, record)) {
+		apply(record);
+		valid += line.length() + 1;
+		records++;
+	}
+	// Anything after the first bad line was never acknowledged: a write
+	// torn by the crash, which must not be followed by newer records
+	bool torn = !in.eof() || !line.empty();
+	in.close();
+
+	if (torn && truncateTail) {
+		std::cerr << "WAL: dropping the torn tail of " << path << " after " << records << " records" << std::endl;
+		if (truncate(path.c_str(), valid) < 0) {
+			perror("WAL truncate:");
+			return -1;
+		}
+	}
+	if (records) {
+		std::cerr << "WAL: replayed " << records << " records from " << path << std::endl;
+	}
+	return valid;
+}
+
+int DurableRoster::open() {
+	if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+		perror("WAL mkdir:");
+		return -1;
+	}
+
+	// Step 1: Recover: the checkpoint, then the logs on top of it
+	std::string logPath = dir + "/log";
+	folding = access((logPath + ".old").c_str(), F_OK) == 0;
+	if (replay(dir + "/checkpoint", false) < 0) {
+		perror("WAL checkpoint:");
+		return -1;
+	}
+	if (folding && replay(logPath + ".old", false) < 0) {
+		perror("WAL log.old:");
+		return -1;
+	}
+	long valid = replay(logPath, true);
+	if (valid < 0) {
+		perror("WAL log:");
+		return -1;
+	}
+
+	// A checkpoint was cut short: finish it before the log is swapped again
+	if (folding && checkpoint() < 0) {
+		return -1;
+	}
+	folding = false;
+
+	// Step 2: Append to the log from where the valid records end
+	logFd = ::open(logPath.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (logFd < 0 || syncDir(dir) < 0) {
+		perror("WAL open:");
+		return -1;
+	}
+	logBytes = valid;
+
+	// Step 3: Start the flusher and the checkpointer
+	if (pthread_create(&checkpointer, NULL, runCheckpointer, this) != 0) {
+		perror("WAL checkpointer:");
+		return -1;
+	}
+	checkpointerStarted = true;
+	if (pthread_create(&flusher, NULL, runFlusher, this) != 0) {
+		perror("WAL flusher:");
+		return -1;
+	}
+	flusherStarted = true;
+	return 0;
+}
+
+bool DurableRoster::find(const std::string & groupId, const std::string & studentId, std::string & studentName) const {
+	return index->find(groupId, studentId, studentName);
+}
+
+bool DurableRoster::put(const std::string & groupId, const std::string & studentId, const std::string & studentName) {
+	WalRecord record = {'P', groupId, studentId, studentName};
+	return submit(record) > 0;
+}
+
+int DurableRoster::del(const std::string & groupId, const std::string & studentId) {
+	// Nothing to delete: answer without waiting for a commit (the flusher
+	// checks again, against the writes queued before this one)
+	std::string studentName;
+	if (!index->find(groupId, studentId, studentName)) {
+		return 0;
+	}
+	WalRecord record = {'D', groupId, studentId, ""};
+	return submit(record);
+}
+
+void DurableRoster::scan(RosterVisitor visit, void * arg) const {
+	index->scan(visit, arg);
+}
+
+// Queues record for the flusher, and waits until it is durable and applied
+int DurableRoster::submit(WalRecord & record) {
+	PendingWrite write;
+	write.record = record;
+	write.line = encodeRecord(record);
+	write.queuedNanos = nowNanos();
+	write.logged = false;
+	write.done = false;
+	write.result = -1;
+
+	pthread_mutex_lock(&m);
+	if (failed || stopping) {
+		pthread_mutex_unlock(&m);
+		return -1;
+	}
+	pending.push_back(&write);
+	if (pending.size() == 1 || pending.size() >= WAL_MAX_BATCH) {
+		pthread_cond_signal(&queued);
+	}
+	while (!write.done) {
+		pthread_cond_wait(&flushed, &m);
+	}
+	pthread_mutex_unlock(&m);
+	return write.result;
+}
+
+void * DurableRoster::runFlusher(void * self) {
+	((DurableRoster *) self)->flush();
+	return NULL;
+}
+
+int DurableRoster::writeAll(int fd, const std::string & data) {
+	for (size_t off = 0; off < data.length(); ) {
+		int l = write(fd, data.data() + off, data.length() - off);
+		if (l < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		off += l;
+	}
+	return 0;
+}
+
+void DurableRoster::flush() {
+	std::vector<PendingWrite *> batch;
+	pthread_mutex_lock(&m);
+	while (true) {
+		// Step 1: Wait for a write, then for more to join it, up to the latency bound
+		while (pending.empty() && !stopping) {
+			pthread_cond_wait(&queued, &m);
+		}
+		if (pending.empty()) {
+			break;
+		}
+		uint64_t deadline = pending.front()->queuedNanos + syncDelayMicros * 1000;
+		while (!stopping && pending.size() < WAL_MAX_BATCH && nowNanos() < deadline) {
+			timespec ts = {(time_t) (deadline / 1000000000ull), (long) (deadline % 1000000000ull)};
+			pthread_cond_timedwait(&queued, &m, &ts);
+		}
+		batch.swap(pending);
+		pthread_mutex_unlock(&m);
+
+		// Step 2: One write and one fdatasync for the whole batch; a DEL
+		// of a student that isn't there, once the writes before it are
+		// applied, is left out
+		std::string data;
+		std::map<std::pair<std::string, std::string>, bool> present;
+		for (size_t i = 0; i < batch.size(); i++) {
+			const WalRecord & record = batch[i]->record;
+			std::pair<std::string, std::string> key(record.groupId, record.studentId);
+			std::map<std::pair<std::string, std::string>, bool>::iterator it = present.find(key);
+			std::string studentName;
+			bool there = it != present.end() ? it->second : index->find(record.groupId, record.studentId, studentName);
+			batch[i]->logged = record.op == 'P' || there;
+			present[key] = record.op == 'P';
+			if (batch[i]->logged) {
+				data += batch[i]->line;
+			}
+		}
+		bool ok = !failed && (data.empty() || (writeAll(logFd, data) == 0 && fdatasync(logFd) == 0));
+		if (!ok && !failed) {
+			// The state of the file is unknown after a failed write or
+			// sync (the kernel may have dropped the dirty pages): stop here
+			perror("WAL write:");
+		}
+
+		// Step 3: Make the batch visible, in log order
+		if (ok) {
+			for (size_t i = 0; i < batch.size(); i++) {
+				batch[i]->result = batch[i]->logged ? apply(batch[i]->record) : 0;
+			}
+			logBytes += data.length();
+		}
+
+		// Step 4: Hand a full log to the checkpointer, unless it is
+		// still busy with the last one
+		if (ok && logBytes > 0 && logBytes >= checkpointBytes) {
+			pthread_mutex_lock(&checkpointM);
+			bool busy = folding;
+			pthread_mutex_unlock(&checkpointM);
+			if (!busy && swapLog() < 0) {
+				ok = false;
+			}
+		}
+
+		pthread_mutex_lock(&m);
+		if (!ok) {
+			failed = true;
+		}
+		for (size_t i = 0; i < batch.size(); i++) {
+			batch[i]->done = true;
+		}
+		batch.clear();
+		pthread_cond_broadcast(&flushed);
+	}
+	pthread_mutex_unlock(&m);
+}
+
+// Renames the log to log.old, starts a new one and wakes the checkpointer
+// Returns 0 on success and -1 on error
+int DurableRoster::swapLog() {
+	std::string logPath = dir + "/log";
+	close(logFd);
+	logFd = -1;
+	if (rename(logPath.c_str(), (logPath + ".old").c_str()) < 0
+		|| (logFd = ::open(logPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644)) < 0
+		|| syncDir(dir) < 0) {
+		perror("WAL swap:");
+		return -1;
+	}
+	logBytes = 0;
+
+	pthread_mutex_lock(&checkpointM);
+	folding = true;
+	pthread_cond_signal(&checkpointDue);
+	pthread_mutex_unlock(&checkpointM);
+	return 0;
+}
+
+void * DurableRoster::runCheckpointer(void * self) {
+	((DurableRoster *) self)->checkpoints();
+	return NULL;
+}
+
+void DurableRoster::checkpoints() {
+	pthread_mutex_lock(&checkpointM);
+	while (true) {
+		while (!folding && !checkpointerStopping) {
+			pthread_cond_wait(&checkpointDue, &checkpointM);
+		}
+		if (!folding) {
+			break;
+		}
+		pthread_mutex_unlock(&checkpointM);
+		int ret = checkpoint();
+		pthread_mutex_lock(&checkpointM);
+
+		// log.old stays on failure (recovery still reads it), and no log
+		// may take its place: refuse further writes
+		if (ret < 0) {
+			pthread_mutex_lock(&m);
+			failed = true;
+			pthread_mutex_unlock(&m);
+			break;
+		}
+		folding = false;
+	}
+	pthread_mutex_unlock(&checkpointM);
+}
+
+// Reads the valid records of the file at path into net, the last per
+// student winning
+// Returns 0 on success and -1 on error
+static int readNet(const std::string & path, std::map<std::pair<std::string, std::string>, WalRecord> & net) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		return errno == ENOENT ? 0 : -1;
+	}
+	std::string line;
+	WalRecord record;
+	while (std::getline(in, line) && !in.eof() && decodeRecord(line, record)) {
+		net[std::make_pair(record.groupId, record.studentId)] = record;
+	}
+	return in.bad() ? -1 : 0;
+}
+
+// Merges the checkpoint and log.old into a new checkpoint, then removes
+// log.old (runs beside the flusher, which only appends to the new log)
+// Returns 0 on success and -1 on error
+int DurableRoster::checkpoint() {
+	std::string path = dir + "/checkpoint", tmpPath = path + ".tmp", oldLogPath = dir + "/log.old";
+	std::map<std::pair<std::string, std::string>, WalRecord> net;
+	if (readNet(path, net) < 0 || readNet(oldLogPath, net) < 0) {
+		perror("WAL checkpoint:");
+		return -1;
+	}
+	int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("WAL checkpoint:");
+		return -1;
+	}
+
+	std::string data;
+	int ret = 0;
+	std::map<std::pair<std::string, std::string>, WalRecord>::const_iterator it;
+	for (it = net.begin(); it != net.end() && ret == 0; ++it) {
+		data += encodeRecord(it->second);
+		if (data.length() >= (1 << 20)) {
+			ret = writeAll(fd, data);
+			data.clear();
+		}
+	}
+	if (ret == 0) ret = writeAll(fd, data);
+	if (ret == 0) ret = fdatasync(fd);
+	close(fd);
+
+	// The rename is the commit point: a crash before it leaves the old
+	// checkpoint and log.old, a crash after it replays log.old records
+	// the checkpoint already holds, which is harmless
+	if (ret == 0) ret = rename(tmpPath.c_str(), path.c_str());
+	if (ret == 0) ret = syncDir(dir);
+	if (ret == 0) ret = unlink(oldLogPath.c_str());
+	if (ret == 0) ret = syncDir(dir);
+	if (ret < 0) {
+		perror("WAL checkpoint:");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "concurrentRoster.h"
+#include "roster.h"
+
+// WRITE-AHEAD LOG
+// Makes PUT/DEL survive a crash. The roster read from stdin at startup is
+// the base; the log directory holds only the changes made since:
+//
+//   <dir>/checkpoint  the net change (last PUT or DEL per student) as of
+//                     the last checkpoint, replaced atomically by rename()
+//   <dir>/log.old     the log being folded into the next checkpoint, if any
+//   <dir>/log         every change since, in order
+//
+// All are lines of "<crc32 in hex> P <group> <student> <name>" or
+// "<crc32 in hex> D <group> <student>"; a log is only read up to its first
+// torn or corrupt line. Recovery loads stdin, then the checkpoint, log.old
+// and the log. Once the log outgrows --checkpoint-mb the flusher renames
+// it to log.old and starts a new one; a checkpointer thread merges the
+// checkpoint with log.old into a new checkpoint and removes log.old, so
+// commits never wait for a checkpoint to be written. Recovery replays at
+// most two checkpoint intervals of history plus the (deduplicated)
+// checkpoint itself
+//
+// Group commit: writers queue their record and wait; one flusher thread
+// writes everything queued with one write() and one fdatasync(), applies
+// the batch to the index in log order, then wakes the writers. The flusher
+// lingers up to --sync-us after the oldest queued record to let more
+// writers join the batch. Changes only become visible once durable. A DEL
+// of a student that isn't there changes nothing, and isn't logged
+
+struct WalRecord {
+	char op;							// 'P' or 'D'
+	std::string groupId, studentId, studentName;
+};
+
+// Formats record as one log line, with its checksum
+std::string encodeRecord(const WalRecord & record);
+
+// Parses a log line written by encodeRecord() (without its '\n')
+// Returns false if the line is malformed or its checksum doesn't match
+bool decodeRecord(const std::string & line, WalRecord & record);
+
+class DurableRoster : public Roster {
+	struct PendingWrite {
+		WalRecord record;
+		std::string line;
+		uint64_t queuedNanos;
+		bool logged;
+		bool done;
+		int result;
+	};
+
+	ConcurrentRoster * index;
+
+	std::string dir;
+	long syncDelayMicros;
+	size_t checkpointBytes;
+	int logFd;
+	size_t logBytes;
+
+	pthread_t flusher;
+	bool flusherStarted;
+	pthread_mutex_t m;
+	pthread_cond_t queued;				// the flusher has work
+	pthread_cond_t flushed;				// some writes are done
+	std::vector<PendingWrite *> pending;
+	bool stopping;
+	bool failed;						// an I/O error: refuse all further writes
+
+	pthread_t checkpointer;
+	bool checkpointerStarted;
+	pthread_mutex_t checkpointM;
+	pthread_cond_t checkpointDue;		// log.old is waiting to be folded in
+	bool folding;						// log.old exists
+	bool checkpointerStopping;
+
+	int apply(const WalRecord & record);
+	long replay(const std::string & path, bool truncateTail);
+	int writeAll(int fd, const std::string & data);
+	int swapLog();
+	int checkpoint();
+	int submit(WalRecord & record);
+
+	static void * runFlusher(void * self);
+	void flush();
+	static void * runCheckpointer(void * self);
+	void checkpoints();
+
+public:
+	DurableRoster(ConcurrentRoster * index, const std::string & dir, long syncDelayMicros, size_t checkpointBytes);
+	~DurableRoster();
+
+	// Replays the checkpoint and the log of dir onto the index (which holds
+	// the stdin roster), then starts logging
+	// Returns 0 on success and -1 on error
+	int open();
+
+	bool find(const std::string & groupId, const std::string & studentId, std::string & studentName) const;
+	bool writable() const { return true; }
+	bool put(const std::string & groupId, const std::string & studentId, const std::string & studentName);
+	int del(const std::string & groupId, const std::string & studentId);
+	void scan(RosterVisitor visit, void * arg) const;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+/*
+	Synthetic roster and request mix, used to train the release build
+	(make release) and handy for load testing
+
+	Usage: workload roster <groups> <students per group>
+	       workload requests <groups> <students per group> <count>
+
+	roster    prints a roster for the servers' stdin
+	requests  prints client input for that roster: mostly GETs of existing
+	          students, with misses, invalid input, PUTs and DELs mixed in
+	          (in proportions set by the MIX_ constants below)
+*/
+
+// Percent of requests of each kind (the rest are GETs of existing students)
+#define MIX_MISS 8
+#define MIX_INVALID 2
+#define MIX_PUT 6
+#define MIX_DEL 3
+
+// Student IDs start here, so that they all have the same number of digits
+#define FIRST_STUDENT_ID 10000000
+
+static const char * FIRST_NAMES[] = {
+	"Alice", "Bob", "Carol", "Dan", "Erin", "Frank", "Grace", "Heidi",
+	"Ivan", "Judy", "Mallory", "Niaj", "Olivia", "Peggy", "Rupert", "Sybil",
+	"Trent", "Victor", "Walter", "Yasmin"
+};
+static const char * LAST_NAMES[] = {
+	"Smith", "Jones", "Williams", "Brown", "Taylor", "Davies", "Evans", "Wilson",
+	"Thomas", "Johnson", "Roberts", "Walker", "Wright", "Robinson", "Thompson",
+	"White", "Hughes", "Edwards", "Green", "Lewis-Hall"
+};
+
+#define COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+// xorshift64*: the same output on every run and every machine
+static uint64_t state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t random64() {
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545f4914f6cdd1dull;
+}
+
+static std::string studentName(uint64_t r) {
+	std::string name = FIRST_NAMES[r % COUNT(FIRST_NAMES)];
+	name += " ";
+	name += LAST_NAMES[(r / COUNT(FIRST_NAMES)) % COUNT(LAST_NAMES)];
+	return name;
+}
+
+static void printRoster(unsigned long groups, unsigned long students) {
+	for (unsigned long g = 1; g <= groups; g++) {
+		std::cout << "group " << g << "\n";
+		for (unsigned long s = 0; s < students; s++) {
+			std::cout << FIRST_STUDENT_ID + s << " " << studentName(random64()) << "\n";
+		}
+	}
+}
+
+static void printRequests(unsigned long groups, unsigned long students, unsigned long count) {
+	for (unsigned long i = 0; i < count; i++) {
+		unsigned long kind = random64() % 100;
+		unsigned long g = 1 + random64() % groups;
+		unsigned long s = FIRST_STUDENT_ID + random64() % students;
+
+		if (kind < MIX_MISS) {
+			// Either the group or the student does not exist
+			if (kind % 2) {
+				std::cout << groups + g << " " << s << "\n";
+			} else {
+				std::cout << g << " " << s + students << "\n";
+			}
+		} else if ((kind -= MIX_MISS) < MIX_INVALID) {
+			std::cout << (kind % 2 ? "not a request\n" : "12a 34\n");
+		} else if ((kind -= MIX_INVALID) < MIX_PUT) {
+			std::cout << "PUT " << g << " " << s << " " << studentName(random64()) << "\n";
+		} else if ((kind -= MIX_PUT) < MIX_DEL) {
+			std::cout << "DEL " << g << " " << s << "\n";
+		} else {
+			std::cout << g << " " << s << "\n";
+		}
+	}
+}
+
+// MAIN
+
+int main(int argc, char * argv[]) {
+	bool roster = argc == 4 && !strcmp(argv[1], "roster");
+	bool requests = argc == 5 && !strcmp(argv[1], "requests");
+	if (!roster && !requests) {
+		std::cerr << "usage : " << argv[0] << " roster <groups> <students per group>" << std::endl;
+		std::cerr << "        " << argv[0] << " requests <groups> <students per group> <count>" << std::endl;
+		return 1;
+	}
+
+	unsigned long groups = strtoul(argv[2], NULL, 10);
+	unsigned long students = strtoul(argv[3], NULL, 10);
+	if (groups == 0 || students == 0) {
+		std::cerr << "workload: need at least one group and one student" << std::endl;
+		return 1;
+	}
+
+	std::ios::sync_with_stdio(false);
+	if (roster) {
+		printRoster(groups, students);
+	} else {
+		printRequests(groups, students, strtoul(argv[4], NULL, 10));
+	}
+	return 0;
+}